@@ -0,0 +1,141 @@
+// Copyright (c) 2024 Pyarelal Knowles, MIT License
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <decodeless/mappedfile.hpp>
+#include <filesystem>
+#include <string>
+
+using namespace decodeless;
+
+namespace {
+
+constexpr size_t KiB = 1024;
+constexpr size_t MiB = 1024 * KiB;
+constexpr size_t GiB = 1024 * MiB;
+
+// Creates a file of the given size, removed when the object goes out of scope
+class TempFile {
+public:
+    TempFile(const std::string& name, size_t size)
+        : m_path(fs::temp_directory_path() / ("decodeless_bench_" + name)) {
+        fs::remove(m_path);
+        if (size) {
+            resizable_file file(m_path, size);
+            file.resize(size);
+        }
+    }
+    TempFile(const TempFile& other) = delete;
+    TempFile& operator=(const TempFile& other) = delete;
+    ~TempFile() { fs::remove(m_path); }
+    const fs::path& path() const { return m_path; }
+
+private:
+    fs::path m_path;
+};
+
+size_t pageBytes() { return size_t(detail::pageSize()); }
+
+// Latency of opening and mapping a read-only file, by file size
+void FileOpen(benchmark::State& state) {
+    TempFile temp("open.dat", size_t(state.range(0)));
+    for (auto _ : state) {
+        file mapped(temp.path());
+        benchmark::DoNotOptimize(mapped.data());
+    }
+}
+BENCHMARK(FileOpen)->RangeMultiplier(16)->Range(4 * KiB, 1 * GiB);
+
+// Growing a resizable_file to 64 MiB in steps of the given size, with exact (0), geometric (1) or
+// preallocated geometric (2) growth. Includes the final trim on destruction.
+void ResizableFileResize(benchmark::State& state) {
+    size_t        step = size_t(state.range(0));
+    growth_policy growth = state.range(1) == 0   ? growth_policy::exact()
+                           : state.range(1) == 1 ? growth_policy::geometric()
+                                                 : growth_policy::geometric().preallocated();
+    TempFile      temp("resize.dat", 0);
+    for (auto _ : state) {
+        resizable_file file(temp.path(), 64 * MiB, growth);
+        for (size_t size = step; size <= 64 * MiB; size += step)
+            file.resize(size);
+        benchmark::DoNotOptimize(file.data());
+        state.PauseTiming();
+        file.resize(0);
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(int64_t(state.iterations() * (64 * MiB / step)));
+    state.SetBytesProcessed(int64_t(state.iterations() * 64 * MiB));
+}
+BENCHMARK(ResizableFileResize)
+    ->ArgNames({"step", "growth"})
+    ->ArgsProduct({{4 * KiB, 64 * KiB, 1 * MiB}, {0, 1, 2}})
+    ->Unit(benchmark::kMillisecond);
+
+// Committing and then releasing resizable_memory in steps of the given size
+void ResizableMemoryCommit(benchmark::State& state) {
+    size_t           step = size_t(state.range(0));
+    resizable_memory memory(0, 256 * MiB);
+    for (auto _ : state) {
+        for (size_t size = step; size <= 256 * MiB; size += step)
+            memory.resize(size);
+        for (size_t size = 256 * MiB; size >= step; size -= step)
+            memory.resize(size - step);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(int64_t(state.iterations() * 2 * (256 * MiB / step)));
+}
+BENCHMARK(ResizableMemoryCommit)
+    ->RangeMultiplier(16)
+    ->Range(4 * KiB, 16 * MiB)
+    ->Unit(benchmark::kMillisecond);
+
+// Page fault rate when first touching every page of a freshly mapped file, with and without
+// prefaulting it when mapping. Items are pages.
+void FileFirstTouch(benchmark::State& state) {
+    bool     populate = state.range(0) != 0;
+    TempFile temp("touch.dat", 64 * MiB);
+    size_t   ps = pageBytes();
+    for (auto _ : state) {
+        file mapped = populate ? file(temp.path(), prefault{}) : file(temp.path());
+        auto bytes = reinterpret_cast<const volatile uint8_t*>(mapped.data());
+        for (size_t i = 0; i < mapped.size(); i += ps)
+            (void)bytes[i];
+    }
+    state.SetItemsProcessed(int64_t(state.iterations() * (64 * MiB / ps)));
+}
+BENCHMARK(FileFirstTouch)->ArgName("prefault")->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+// Page fault rate when first touching every page of resizable_memory. Items are pages.
+void ResizableMemoryFirstTouch(benchmark::State& state) {
+    size_t ps = pageBytes();
+    for (auto _ : state) {
+        resizable_memory memory(64 * MiB, 64 * MiB);
+        auto             bytes = reinterpret_cast<volatile uint8_t*>(memory.data());
+        for (size_t i = 0; i < memory.size(); i += ps)
+            bytes[i] = 1;
+    }
+    state.SetItemsProcessed(int64_t(state.iterations() * (64 * MiB / ps)));
+}
+BENCHMARK(ResizableMemoryFirstTouch)->Unit(benchmark::kMillisecond);
+
+// Cost of flushing the given number of dirty pages of a writable file
+void WritableFileFlush(benchmark::State& state) {
+    size_t        pages = size_t(state.range(0));
+    size_t        ps = pageBytes();
+    TempFile      temp("flush.dat", pages * ps);
+    writable_file mapped(temp.path(), durability::none);
+    auto          bytes = reinterpret_cast<uint8_t*>(mapped.data());
+    uint8_t       value = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        ++value;
+        for (size_t i = 0; i < mapped.size(); i += ps)
+            bytes[i] = value;
+        state.ResumeTiming();
+        mapped.flush();
+    }
+    state.SetItemsProcessed(int64_t(state.iterations() * pages));
+}
+BENCHMARK(WritableFileFlush)->RangeMultiplier(8)->Range(1, 4096)->Unit(benchmark::kMillisecond);
+
+} // namespace
@@ -0,0 +1,149 @@
+// Copyright (c) 2024 Pyarelal Knowles, MIT License
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__x86_64__)
+    #include <nmmintrin.h>
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #endif
+    #define DECODELESS_CRC32C_SSE42 1
+#elif defined(__ARM_FEATURE_CRC32)
+    #include <arm_acle.h>
+    #define DECODELESS_CRC32C_ARM 1
+#endif
+
+namespace decodeless {
+
+namespace detail {
+
+// CRC-32C (Castagnoli), as used by iSCSI, ext4 and SSE4.2, in its reflected form
+static constexpr uint32_t Crc32cPolynomial = 0x82f63b78;
+
+// Tables for the portable slicing-by-8 implementation
+inline constexpr std::array<std::array<uint32_t, 256>, 8> crc32cTables() {
+    std::array<std::array<uint32_t, 256>, 8> result{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (crc & 1 ? Crc32cPolynomial : 0);
+        result[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i)
+        for (size_t table = 1; table < 8; ++table)
+            result[table][i] = (result[table - 1][i] >> 8) ^ result[0][result[table - 1][i] & 0xff];
+    return result;
+}
+
+// Updates a raw, i.e. not inverted, CRC state
+inline uint32_t crc32cSoftware(uint32_t crc, const std::byte* bytes, size_t size) {
+    static constexpr auto tables = crc32cTables();
+    for (; size >= 8; bytes += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word)); // little endian only, like the hardware paths
+        word ^= crc;
+        crc = tables[7][word & 0xff] ^ tables[6][(word >> 8) & 0xff] ^
+              tables[5][(word >> 16) & 0xff] ^ tables[4][(word >> 24) & 0xff] ^
+              tables[3][(word >> 32) & 0xff] ^ tables[2][(word >> 40) & 0xff] ^
+              tables[1][(word >> 48) & 0xff] ^ tables[0][word >> 56];
+    }
+    for (; size; ++bytes, --size)
+        crc = (crc >> 8) ^ tables[0][(crc ^ uint32_t(*bytes)) & 0xff];
+    return crc;
+}
+
+#if DECODELESS_CRC32C_SSE42
+    #if defined(_MSC_VER) && !defined(__clang__)
+        #define DECODELESS_TARGET_SSE42
+    #else
+        #define DECODELESS_TARGET_SSE42 __attribute__((target("sse4.2")))
+    #endif
+
+DECODELESS_TARGET_SSE42 inline uint32_t crc32cHardware(uint32_t crc, const std::byte* bytes,
+                                                       size_t size) {
+    uint64_t crc64 = crc;
+    for (; size >= 8; bytes += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = uint32_t(crc64);
+    for (; size; ++bytes, --size)
+        crc = _mm_crc32_u8(crc, uint8_t(*bytes));
+    return crc;
+}
+
+inline bool hasCrc32cHardware() {
+    #if defined(_MSC_VER) && !defined(__clang__)
+    static const bool result = [] {
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 20)) != 0;
+    }();
+    return result;
+    #else
+    static const bool result = __builtin_cpu_supports("sse4.2");
+    return result;
+    #endif
+}
+#elif DECODELESS_CRC32C_ARM
+inline uint32_t crc32cHardware(uint32_t crc, const std::byte* bytes, size_t size) {
+    for (; size >= 8; bytes += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        crc = __crc32cd(crc, word);
+    }
+    for (; size; ++bytes, --size)
+        crc = __crc32cb(crc, uint8_t(*bytes));
+    return crc;
+}
+
+inline bool hasCrc32cHardware() { return true; }
+#endif
+
+// Continues a CRC-32C from crc, which is 0 for the first block, over size bytes
+inline uint32_t crc32c(uint32_t crc, const void* data, size_t size) {
+    auto* bytes = static_cast<const std::byte*>(data);
+#if DECODELESS_CRC32C_SSE42 || DECODELESS_CRC32C_ARM
+    if (hasCrc32cHardware())
+        return ~crc32cHardware(~crc, bytes, size);
+#endif
+    return ~crc32cSoftware(~crc, bytes, size);
+}
+
+// a * b modulo the polynomial, both reflected
+constexpr uint32_t crc32cMultiply(uint32_t a, uint32_t b) {
+    uint32_t result = 0;
+    for (uint32_t bit = 1u << 31; bit; bit >>= 1) {
+        if (a & bit)
+            result ^= b;
+        b = (b >> 1) ^ (b & 1 ? Crc32cPolynomial : 0);
+    }
+    return result;
+}
+
+// x^(8 * bytes) modulo the polynomial. Pass to crc32cCombine().
+constexpr uint32_t crc32cShift(size_t bytes) {
+    uint32_t result = 1u << 31; // x^0
+    uint32_t power = 1u << 23;  // x^8, squared for each bit of bytes
+    for (; bytes; bytes >>= 1) {
+        if (bytes & 1)
+            result = crc32cMultiply(power, result);
+        power = crc32cMultiply(power, power);
+    }
+    return result;
+}
+
+// Returns the CRC-32C of A followed by B given crc32c(A), crc32c(B) and crc32cShift(size of B)
+constexpr uint32_t crc32cCombine(uint32_t crcA, uint32_t crcB, uint32_t shiftB) {
+    return crc32cMultiply(shiftB, crcA) ^ crcB;
+}
+
+} // namespace detail
+
+} // namespace decodeless
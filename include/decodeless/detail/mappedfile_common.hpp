@@ -2,9 +2,21 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <new>
 #include <stdexcept>
+#include <stop_token>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace decodeless {
 
@@ -21,4 +33,406 @@ public:
     using fs::filesystem_error::filesystem_error;
 };
 
+// When writable file mappings implicitly write dirty pages back to the file. Data is never lost
+// by skipping a flush as the OS still writes pages back eventually, but a crash or power loss may
+// leave the file partially written.
+enum class durability {
+    none,          // Never flush implicitly, leaving writeback to the OS
+    async,         // Start writeback on each resize() and on close, but don't wait for it
+    sync,          // Wait for writeback on each resize() and on close
+    sync_on_close, // Wait for writeback only when the mapping is closed
+};
+
+// Access pattern hints for advise(). These may be ignored by the OS. Note that dontneed discards
+// the contents of anonymous memory, i.e. resizable_memory. It reads back zeroes on Linux but its
+// contents are undefined on Windows, where DiscardVirtualMemory() is used.
+enum class access_pattern {
+    normal,     // Default readahead
+    sequential, // Aggressive readahead, pages may be freed soon after access
+    random,     // Little to no readahead
+    willneed,   // Start reading the range in now
+    dontneed,   // The range won't be accessed soon and its pages may be released
+    hugepage,   // Back the range with transparent huge pages where supported
+};
+
+// Populates the page tables of a file mapping up front so later accesses don't each take a page
+// fault. The range defaults to the whole file and is clamped to the file size. With background,
+// pages are populated by a thread owned by the mapping, which is stopped and joined when the
+// mapping is destroyed.
+struct prefault {
+    size_t offset = 0;
+    size_t length = std::numeric_limits<size_t>::max();
+    bool   background = false;
+};
+
+// Pages used to back resizable_memory. Transparent huge pages are only a hint and fall back to
+// normal pages. Explicit huge pages must be made available by the system, e.g. with
+// /proc/sys/vm/nr_hugepages on Linux or the "Lock pages in memory" privilege on Windows, or
+// allocation fails with mapping_error.
+enum class page_size {
+    normal,
+    transparent_huge, // Linux THP, committed in 2 MiB granules
+    huge_2mb,         // Linux MAP_HUGETLB, Windows MEM_LARGE_PAGES
+    huge_1gb,         // Linux MAP_HUGETLB, Windows MEM_LARGE_PAGES
+};
+
+// How writes through a writable file mapping reach the file
+enum class sharing {
+    shared,        // Writes go to the file and are seen by other mappings of it
+    copy_on_write, // Writes stay private to the mapping. The file may even be read-only.
+};
+
+// Compile time options for basic_file and basic_writable_file, resolved to the flags of the
+// underlying calls when the type is instantiated. The defaults match file and writable_file.
+struct file_policy {
+    sharing    share = sharing::shared;
+    bool       populate = false;          // prefault the whole file when it is opened
+    page_size  pages = page_size::normal; // transparent_huge only, for filesystems that allow it
+    durability sync = durability::sync;   // implicit writeback on close for shared mappings
+};
+
+// Controls how far the backing file of a resizable_file grows past the requested size. Larger
+// steps make most resize() calls pure bookkeeping at the cost of a temporarily larger file, which
+// is trimmed back to the final size() when the object is destroyed.
+struct growth_policy {
+    // Grow the file to exactly the requested size, the default
+    static constexpr growth_policy exact() { return {}; }
+
+    // Grow the file to at least factor times its current size
+    static constexpr growth_policy geometric(double factor = 2.0, size_t chunk = 1) {
+        return {factor, chunk};
+    }
+
+    // Grow the file in multiples of chunk bytes
+    static constexpr growth_policy chunked(size_t chunk) { return {1.0, chunk}; }
+
+    // Copy with preallocate set
+    constexpr growth_policy preallocated() const {
+        growth_policy result = *this;
+        result.preallocate = true;
+        return result;
+    }
+
+    // Returns the new backing size for a requested size, never exceeding limit
+    constexpr size_t operator()(size_t current, size_t requested, size_t limit) const {
+        double scaled = double(current) * factor;
+        if (requested >= limit || scaled >= double(limit))
+            return limit;
+        size_t result = std::max(requested, static_cast<size_t>(scaled));
+        size_t remainder = chunk > 1 ? result % chunk : 0;
+        if (remainder == 0)
+            return result;
+        return chunk - remainder < limit - result ? result + chunk - remainder : limit;
+    }
+
+    double factor = 1.0;
+    size_t chunk = 1;
+
+    // Allocate disk blocks for the whole backing file when growing it, rather than creating a
+    // sparse file that allocates blocks in page faults as it is written. Reduces fragmentation
+    // and fault latency at the cost of the blocks being allocated up front.
+    bool preallocate = false;
+};
+
+// NUMA node placement for memory as resizable_memory and resizable_shared_memory commit it.
+// Without one, pages are placed on the node of whichever thread first touches them. Existing
+// pages are never migrated. Windows only has preferred nodes, so bind is treated as preferred and
+// interleave alternates nodes every allocation granularity sized chunk. Nodes are held in a 64
+// bit mask, so only nodes 0 to 63 can be used.
+struct numa_placement {
+    enum class mode { local, bind, interleave, preferred };
+
+    // First touch placement, the default
+    static constexpr numa_placement local() { return {}; }
+
+    // Allocate only from the given node, failing if it has no free memory. Throws mapping_error
+    // for nodes above 63.
+    static constexpr numa_placement bind(unsigned node) { return {mode::bind, nodeMask(node)}; }
+
+    // Spread pages across the nodes in the mask, bit i for node i, so at most nodes 0 to 63
+    static constexpr numa_placement interleave(uint64_t nodes) {
+        return {mode::interleave, nodes};
+    }
+
+    // Allocate from the given node when possible, otherwise fall back to others. Throws
+    // mapping_error for nodes above 63.
+    static constexpr numa_placement preferred(unsigned node) {
+        return {mode::preferred, nodeMask(node)};
+    }
+
+    mode     policy = mode::local;
+    uint64_t nodes = 0;
+
+private:
+    static constexpr uint64_t nodeMask(unsigned node) {
+        if (node >= 64)
+            throw mapping_error("NUMA node " + std::to_string(node) +
+                                " is above the 64 node limit");
+        return uint64_t(1) << node;
+    }
+};
+
+// Number and total duration of one kind of operation on a mapping
+struct operation_stats {
+    uint64_t                 count = 0;
+    std::chrono::nanoseconds time{};
+};
+
+// Snapshot returned by stats() of a mapping object, e.g. to export to metrics
+struct mapping_stats {
+    size_t          resident = 0;  // bytes of committed pages currently in physical memory
+    size_t          committed = 0; // bytes backed by the file or by memory
+    size_t          reserved = 0;  // bytes of address space
+    operation_stats resizes;       // resize() calls, including any remaps and syncs they make
+    operation_stats remaps;        // calls to map, extend, remap or release address ranges
+    operation_stats syncs;         // writing back dirty pages
+};
+
+// Page faults counted by a fault_scope
+struct fault_counts {
+    uint64_t major = 0; // needed I/O
+    uint64_t minor = 0; // satisfied from memory, e.g. the page cache
+};
+
+// Byte range of a mapping marked as modified with mark_dirty()
+struct dirty_range {
+    size_t offset = 0;
+    size_t length = 0;
+    bool   operator==(const dirty_range& other) const = default;
+};
+
+namespace detail {
+
+// Adds its lifetime to an operation_stats
+class ScopedTimer {
+public:
+    ScopedTimer(operation_stats& stats)
+        : m_stats(stats)
+        , m_start(std::chrono::steady_clock::now()) {}
+    ScopedTimer(const ScopedTimer& other) = delete;
+    ScopedTimer& operator=(const ScopedTimer& other) = delete;
+    ~ScopedTimer() {
+        ++m_stats.count;
+        m_stats.time += std::chrono::steady_clock::now() - m_start;
+    }
+
+private:
+    operation_stats&                      m_stats;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+// Operation counters kept by each mapping object for stats()
+struct OperationStats {
+    operation_stats resizes;
+    operation_stats remaps;
+    operation_stats syncs;
+
+    mapping_stats snapshot(size_t resident, size_t committed, size_t reserved) const {
+        return {resident, committed, reserved, resizes, remaps, syncs};
+    }
+};
+
+// Returns [begin, end) of the part of [offset, offset + length) within a mapping of the given
+// size, with begin rounded down to a page boundary as required by e.g. madvise()
+inline std::pair<size_t, size_t> pageRange(size_t size, size_t offset, size_t length,
+                                           size_t pageSize) {
+    size_t begin = offset - offset % pageSize;
+    size_t end = std::min(offset + std::min(length, size), size);
+    return {begin, std::max(begin, end)};
+}
+
+// Faults in pages by reading a byte from each one
+inline void touchPages(const void* begin, const void* end, size_t pageSize) {
+    for (auto* p = static_cast<const volatile std::byte*>(begin); p < end; p += pageSize)
+        (void)*p;
+}
+
+// Waits until limit is at least end, with exactly one of any concurrent callers calling grow(end)
+// at a time to raise it. grow() must store the new limit with release ordering. Callers that
+// observe a sufficient limit never block, so once grown this is just an atomic load.
+template <class Grow>
+void growShared(size_t& limit, bool& growing, size_t end, Grow&& grow) {
+    std::atomic_ref published(limit);
+    std::atomic_ref busy(growing);
+    while (published.load(std::memory_order_acquire) < end) {
+        if (busy.exchange(true, std::memory_order_acquire)) {
+            busy.wait(true, std::memory_order_relaxed);
+            continue;
+        }
+        try {
+            if (published.load(std::memory_order_relaxed) < end)
+                grow(end);
+        } catch (...) {
+            busy.store(false, std::memory_order_release);
+            busy.notify_all();
+            throw;
+        }
+        busy.store(false, std::memory_order_release);
+        busy.notify_all();
+    }
+}
+
+// Atomically adds bytes to size, returning the previous value, or throws std::bad_alloc if that
+// would exceed capacity
+inline size_t bumpShared(size_t& size, size_t bytes, size_t capacity) {
+    std::atomic_ref shared(size);
+    size_t          offset = shared.load(std::memory_order_relaxed);
+    do {
+        if (bytes > capacity - std::min(offset, capacity))
+            throw std::bad_alloc();
+    } while (!shared.compare_exchange_weak(offset, offset + bytes, std::memory_order_relaxed));
+    return offset;
+}
+
+// Undoes a bumpShared() that returned offset, e.g. when backing the bytes failed, unless size has
+// already been bumped again by another thread
+inline void unbumpShared(size_t& size, size_t offset, size_t bytes) {
+    size_t expected = offset + bytes;
+    std::atomic_ref(size).compare_exchange_strong(expected, offset, std::memory_order_relaxed);
+}
+
+// Atomically raises published to length with release ordering, so a reader that loads it with
+// acquire ordering also sees every write made before the call. Never lowers it, so concurrent
+// publishers of different lengths leave the largest.
+inline void publishShared(size_t& published, size_t length) {
+    std::atomic_ref shared(published);
+    size_t          current = shared.load(std::memory_order_relaxed);
+    while (current < length &&
+           !shared.compare_exchange_weak(current, length, std::memory_order_release,
+                                         std::memory_order_relaxed))
+        ;
+}
+
+// Acquire load of a length stored by publishShared(). std::atomic_ref<const T> is C++26.
+inline size_t loadPublished(const size_t& published) {
+    return std::atomic_ref(const_cast<size_t&>(published)).load(std::memory_order_acquire);
+}
+
+// Thread safe first fit allocator of aligned sub-ranges of [0, size), e.g. to carve one large
+// address space reservation into many smaller ones. Freed ranges are merged with their neighbours.
+class RangeAllocator {
+public:
+    RangeAllocator(size_t size)
+        : m_available(size) {
+        if (size)
+            m_free.emplace(0, size);
+    }
+    RangeAllocator(const RangeAllocator& other) = delete;
+    RangeAllocator& operator=(const RangeAllocator& other) = delete;
+
+    // Returns the offset of a free range of size bytes with base + offset a multiple of alignment,
+    // or throws std::bad_alloc if there is none
+    size_t allocate(size_t size, size_t alignment, uintptr_t base = 0) {
+        std::lock_guard lock(m_mutex);
+        for (auto it = m_free.begin(); it != m_free.end(); ++it) {
+            auto [offset, length] = *it;
+            size_t aligned = (base + offset + alignment - 1) / alignment * alignment - base;
+            size_t padding = aligned - offset;
+            if (padding > length || size > length - padding)
+                continue;
+            m_free.erase(it);
+            if (padding)
+                m_free.emplace(offset, padding);
+            if (size < length - padding)
+                m_free.emplace(aligned + size, length - padding - size);
+            m_available -= size;
+            return aligned;
+        }
+        throw std::bad_alloc();
+    }
+
+    // Returns a range from allocate()
+    void deallocate(size_t offset, size_t size) {
+        std::lock_guard lock(m_mutex);
+        size_t          begin = offset;
+        size_t          end = offset + size;
+        auto            next = m_free.lower_bound(offset);
+        if (next != m_free.end() && next->first == end) {
+            end += next->second;
+            next = m_free.erase(next);
+        }
+        if (next != m_free.begin()) {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == begin) {
+                begin = prev->first;
+                m_free.erase(prev);
+            }
+        }
+        m_free.emplace(begin, end - begin);
+        m_available += size;
+    }
+
+    // Total free bytes, which may be fragmented
+    size_t available() const {
+        std::lock_guard lock(m_mutex);
+        return m_available;
+    }
+
+private:
+    mutable std::mutex       m_mutex;
+    std::map<size_t, size_t> m_free; // offset to length
+    size_t                   m_available;
+};
+
+// Set of byte ranges marked as modified, merged where they overlap or touch. Thread safe, except
+// for moving.
+class DirtyRanges {
+public:
+    DirtyRanges() = default;
+    DirtyRanges(DirtyRanges&& other) noexcept
+        : m_ranges(std::move(other.m_ranges)) {}
+    DirtyRanges& operator=(DirtyRanges&& other) noexcept {
+        m_ranges = std::move(other.m_ranges);
+        return *this;
+    }
+
+    void mark(size_t offset, size_t length) {
+        if (length == 0)
+            return;
+        size_t          begin = offset;
+        size_t          end = offset + length;
+        std::lock_guard lock(m_mutex);
+        auto            it = m_ranges.upper_bound(begin);
+        if (it != m_ranges.begin() && std::prev(it)->second >= begin) {
+            --it;
+            begin = it->first;
+            end = std::max(end, it->second);
+            it = m_ranges.erase(it);
+        }
+        while (it != m_ranges.end() && it->first <= end) {
+            end = std::max(end, it->second);
+            it = m_ranges.erase(it);
+        }
+        m_ranges.emplace(begin, end);
+    }
+
+    std::vector<dirty_range> ranges() const {
+        std::lock_guard lock(m_mutex);
+        return toVector(m_ranges);
+    }
+
+    // Returns and clears the ranges
+    std::vector<dirty_range> take() {
+        std::map<size_t, size_t> taken;
+        {
+            std::lock_guard lock(m_mutex);
+            taken.swap(m_ranges);
+        }
+        return toVector(taken);
+    }
+
+private:
+    static std::vector<dirty_range> toVector(const std::map<size_t, size_t>& ranges) {
+        std::vector<dirty_range> result;
+        result.reserve(ranges.size());
+        for (auto [begin, end] : ranges)
+            result.push_back({begin, end - begin});
+        return result;
+    }
+    mutable std::mutex       m_mutex;
+    std::map<size_t, size_t> m_ranges; // begin to end
+};
+
+} // namespace detail
+
 } // namespace decodeless
@@ -2,17 +2,30 @@
 
 #pragma once
 
+#include <assert.h>
+#include <condition_variable>
+#include <cstddef>
 #include <decodeless/detail/mappedfile_common.hpp>
 #include <errno.h>
 #include <exception>
 #include <fcntl.h>
 #include <limits>
+#include <linux/fs.h>
+#include <linux/mempolicy.h>
+#include <sys/ioctl.h>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string.h>
 #include <string>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <thread>
 #include <unistd.h>
+#include <vector>
 
 namespace decodeless {
 
@@ -23,6 +36,75 @@ inline long pageSize() {
     return initPagesize;
 }
 
+// msync() flags to apply when closing a writable mapping
+inline int closeSyncFlags(durability mode) {
+    switch (mode) {
+    case durability::none:
+        return 0;
+    case durability::async:
+        return MS_ASYNC;
+    default:
+        return MS_SYNC | MS_INVALIDATE;
+    }
+}
+
+inline int madviseAdvice(access_pattern pattern) {
+    switch (pattern) {
+    case access_pattern::sequential:
+        return MADV_SEQUENTIAL;
+    case access_pattern::random:
+        return MADV_RANDOM;
+    case access_pattern::willneed:
+        return MADV_WILLNEED;
+    case access_pattern::dontneed:
+        return MADV_DONTNEED;
+    case access_pattern::hugepage:
+#ifdef MADV_HUGEPAGE
+        return MADV_HUGEPAGE;
+#endif
+    default:
+        return MADV_NORMAL;
+    }
+}
+
+// Granularity resizable_memory is aligned to and committed in
+inline size_t pageGranularity(page_size pages) {
+    switch (pages) {
+    case page_size::transparent_huge:
+    case page_size::huge_2mb:
+        return size_t(1) << 21;
+    case page_size::huge_1gb:
+        return size_t(1) << 30;
+    default:
+        return pageSize();
+    }
+}
+
+// Extra mmap() flags to commit memory with the given pages
+inline int pageMapFlags(page_size pages) {
+    switch (pages) {
+    case page_size::huge_2mb:
+        return MAP_HUGETLB | (21 << MAP_HUGE_SHIFT);
+    case page_size::huge_1gb:
+        return MAP_HUGETLB | (30 << MAP_HUGE_SHIFT);
+    default:
+        return 0;
+    }
+}
+
+inline int mbindMode(numa_placement::mode policy) {
+    switch (policy) {
+    case numa_placement::mode::bind:
+        return MPOL_BIND;
+    case numa_placement::mode::interleave:
+        return MPOL_INTERLEAVE;
+    case numa_placement::mode::preferred:
+        return MPOL_PREFERRED;
+    default:
+        return MPOL_DEFAULT;
+    }
+}
+
 class LastError : public mapping_error {
 public:
     LastError()
@@ -36,15 +118,47 @@ public:
                             std::error_code(errno, std::system_category())) {}
 };
 
+// Identifies a version of a file without opening it, e.g. to detect that a cached mapping of it
+// is stale because the file was modified or replaced
+class FileIdentity {
+public:
+    FileIdentity(const fs::path& path) {
+        struct stat result;
+        if (::stat(path.c_str(), &result) == -1)
+            throw LastMappedFileError(path);
+        m_device = result.st_dev;
+        m_inode = result.st_ino;
+        m_size = result.st_size;
+        m_modifiedSec = result.st_mtim.tv_sec;
+        m_modifiedNsec = result.st_mtim.tv_nsec;
+    }
+    bool operator==(const FileIdentity& other) const = default;
+
+private:
+    dev_t  m_device;
+    ino_t  m_inode;
+    off_t  m_size;
+    time_t m_modifiedSec;
+    long   m_modifiedNsec;
+};
+
 class FileDescriptor {
 public:
     using StatResult = struct stat;
     FileDescriptor(const fs::path& path, int flags, int mode = 0666 /* octal permissions */)
         : m_fd(open(path.c_str(), flags, mode)) {
-        if (!*this) {
+        if (m_fd == -1) {
             throw LastMappedFileError(path);
         }
     }
+
+    // Takes ownership of an already open file descriptor, e.g. from another syscall
+    explicit FileDescriptor(int fd)
+        : m_fd(fd) {
+        if (m_fd == -1) {
+            throw LastError();
+        }
+    }
     FileDescriptor() = delete;
     FileDescriptor(const FileDescriptor& other) = delete;
     FileDescriptor(FileDescriptor&& other) noexcept
@@ -72,10 +186,214 @@ public:
             throw LastError();
     }
 
+    // Writes all of size bytes at offset, retrying short writes
+    void write(size_t offset, const void* data, size_t size) {
+        auto* bytes = static_cast<const std::byte*>(data);
+        while (size) {
+            ssize_t written = pwrite(m_fd, bytes, size, off_t(offset));
+            if (written == -1 && errno == EINTR)
+                continue;
+            if (written == -1)
+                throw LastError();
+            bytes += written;
+            offset += size_t(written);
+            size -= size_t(written);
+        }
+    }
+
+    // Grows the file to at least size with disk blocks allocated, falling back to truncate() on
+    // filesystems that don't support fallocate()
+    void allocate(size_t size) {
+        size_t current = this->size();
+        if (size <= current)
+            return;
+        if (fallocate(m_fd, 0, off_t(current), off_t(size - current)) == -1) {
+            if (errno != EOPNOTSUPP)
+                throw LastError();
+            truncate(size);
+        }
+    }
+
 private:
     int m_fd;
 };
 
+// Copies up to length bytes from offset in source to targetOffset in target in the kernel with
+// copy_file_range(), which may also share blocks, e.g. on btrfs, XFS and NFS. Returns the bytes
+// copied. That is less than length if the source ends early or if copy_file_range() is not
+// supported between the two files, e.g. EXDEV across filesystems of different types, in which case
+// the caller copies the rest.
+inline size_t copyFileRange(const FileDescriptor& source, size_t offset,
+                            const FileDescriptor& target, size_t targetOffset, size_t length) {
+    off_t  in = off_t(offset);
+    off_t  out = off_t(targetOffset);
+    size_t copied = 0;
+    while (copied < length) {
+        ssize_t result = copy_file_range(source, &in, target, &out, length - copied, 0);
+        if (result == -1 && errno == EINTR)
+            continue;
+        if (result == -1 && (errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP ||
+                             errno == ENOSYS))
+            break;
+        if (result == -1)
+            throw LastError();
+        if (result == 0)
+            break; // the source was truncated
+        copied += size_t(result);
+    }
+    return copied;
+}
+
+// Writes [offset, offset + size) of source to a new file at path, replacing it if it exists. A
+// whole file is reflinked where the filesystem supports it, e.g. btrfs and XFS, sharing blocks
+// copy-on-write so the cost is independent of size. Otherwise copy_file_range() copies in the
+// kernel, which may still share blocks, e.g. on NFS, and anything it can't copy, e.g. to another
+// filesystem, is copied with pread() and pwrite(). Dirty pages of shared mappings are in the page
+// cache and are included. The new file is removed if copying fails. Throws mapping_error if path
+// is the source itself, e.g. by name or a hard link, as O_TRUNC would truncate it under its
+// mappings.
+inline FileDescriptor cloneRange(const FileDescriptor& source, size_t offset, size_t size,
+                                 const fs::path& path) {
+    struct stat existing;
+    if (::stat(path.c_str(), &existing) == 0) {
+        struct stat sourceStat = source.stat();
+        if (existing.st_dev == sourceStat.st_dev && existing.st_ino == sourceStat.st_ino)
+            throw mapping_error("snapshot target is the source file: " + path.string());
+    }
+    FileDescriptor result(path, O_RDWR | O_CREAT | O_TRUNC);
+    try {
+        if (offset == 0 && ioctl(result, FICLONE, int(source)) == 0) {
+            result.truncate(size);
+            return result;
+        }
+        size_t                 copied = copyFileRange(source, offset, result, 0, size);
+        std::vector<std::byte> buffer(std::min(size - copied, size_t(1) << 20));
+        while (copied < size) {
+            ssize_t read = pread(source, buffer.data(), std::min(buffer.size(), size - copied),
+                                 off_t(offset + copied));
+            if (read == -1 && errno == EINTR)
+                continue;
+            if (read == -1)
+                throw LastError();
+            if (read == 0)
+                break; // the source was truncated
+            result.write(copied, buffer.data(), size_t(read));
+            copied += size_t(read);
+        }
+        result.truncate(size);
+    } catch (...) {
+        std::error_code ignored;
+        fs::remove(path, ignored);
+        throw;
+    }
+    return result;
+}
+
+// madvise() the part of [offset, offset + length) that lies within a mapping of the given size.
+// The start is rounded down to the page boundary madvise() requires.
+inline void adviseRange(const void* address, size_t size, size_t offset, size_t length,
+                        access_pattern pattern) {
+    auto [begin, end] = pageRange(size, offset, length, pageSize());
+    if (end == begin)
+        return;
+    if (madvise(reinterpret_cast<std::byte*>(const_cast<void*>(address)) + begin, end - begin,
+                madviseAdvice(pattern)) == -1)
+        throw LastError();
+}
+
+// Locks the pages of [offset, offset + length) within a mapping of the given size in memory so
+// they are never evicted. MLOCK_ONFAULT locks pages as they are faulted in rather than populating
+// the whole range up front. Kernels older than 4.4 fall back to mlock(), which does populate it.
+// Unprivileged processes are limited to RLIMIT_MEMLOCK locked bytes.
+inline void lockRange(const void* address, size_t size, size_t offset, size_t length) {
+    auto [begin, end] = pageRange(size, offset, length, pageSize());
+    if (end == begin)
+        return;
+    const std::byte* start = static_cast<const std::byte*>(address) + begin;
+    if (mlock2(start, end - begin, MLOCK_ONFAULT) == -1 &&
+        (errno != ENOSYS || mlock(start, end - begin) == -1))
+        throw LastError();
+}
+
+inline void unlockRange(const void* address, size_t size, size_t offset, size_t length) {
+    auto [begin, end] = pageRange(size, offset, length, pageSize());
+    if (end != begin && munlock(static_cast<const std::byte*>(address) + begin, end - begin) == -1)
+        throw LastError();
+}
+
+// Returns the bytes of whole pages in [address, address + size) that are in memory. For file
+// mappings this includes pages cached by other mappings of the file.
+inline size_t residentBytes(const void* address, size_t size) {
+    constexpr size_t           chunkPages = 4096;
+    size_t                     ps = pageSize();
+    size_t                     pages = (size + ps - 1) / ps;
+    std::vector<unsigned char> resident(std::min(pages, chunkPages));
+    size_t                     result = 0;
+    auto*                      bytes = reinterpret_cast<std::byte*>(const_cast<void*>(address));
+    for (size_t page = 0; page < pages; page += chunkPages) {
+        size_t count = std::min(chunkPages, pages - page);
+        if (mincore(bytes + page * ps, count * ps, resident.data()) == -1)
+            throw LastError();
+        for (size_t i = 0; i < count; ++i)
+            result += (resident[i] & 1) ? ps : 0;
+    }
+    return result;
+}
+
+// Counts page faults taken by the calling thread from construction, to attribute them to a
+// user specified scope
+class FaultScope {
+public:
+    FaultScope()
+        : m_start(now()) {}
+    fault_counts faults() const {
+        fault_counts current = now();
+        return {current.major - m_start.major, current.minor - m_start.minor};
+    }
+
+private:
+    static fault_counts now() {
+        struct rusage usage;
+        if (getrusage(RUSAGE_THREAD, &usage) == -1)
+            throw LastError();
+        return {uint64_t(usage.ru_majflt), uint64_t(usage.ru_minflt)};
+    }
+    fault_counts m_start;
+};
+
+// Sets the NUMA policy of pages in [address, address + size) that have not been faulted in yet.
+// Calls mbind() directly to avoid a libnuma dependency.
+inline void placeRange(void* address, size_t size, const numa_placement& placement) {
+    if (placement.policy == numa_placement::mode::local || size == 0)
+        return;
+    unsigned long nodes = placement.nodes;
+    if (syscall(__NR_mbind, address, size, mbindMode(placement.policy), &nodes,
+                sizeof(nodes) * 8 + 1, 0) == -1)
+        throw LastError();
+}
+
+// Populates page tables for the part of [offset, offset + length) within a mapping of the given
+// size. Works in chunks so that a stop request is noticed promptly.
+inline void prefaultRange(const void* address, size_t size, size_t offset, size_t length,
+                          std::stop_token stop = {}) {
+    constexpr size_t chunkSize = 16 * 1024 * 1024;
+    size_t           ps = pageSize();
+    auto [begin, end] = pageRange(size, offset, length, ps);
+    auto* bytes = reinterpret_cast<std::byte*>(const_cast<void*>(address));
+    for (size_t chunk = begin; chunk < end && !stop.stop_requested(); chunk += chunkSize) {
+        size_t chunkEnd = std::min(chunk + chunkSize, end);
+#ifdef MADV_POPULATE_READ
+        if (madvise(bytes + chunk, chunkEnd - chunk, MADV_POPULATE_READ) == 0)
+            continue;
+
+        // Kernels before 5.14 fail with EINVAL. Fall back to touching pages.
+        if (errno != EINVAL)
+            throw LastError();
+#endif
+        touchPages(bytes + chunk, bytes + chunkEnd, ps);
+    }
+}
+
 template <int MemoryProtection>
 class MemoryMap {
 public:
@@ -95,7 +413,8 @@ public:
     MemoryMap(MemoryMap&& other) noexcept
         : m_size(other.m_size)
         , m_address(other.m_address)
-        , m_fixed(other.m_fixed) {
+        , m_fixed(other.m_fixed)
+        , m_unmapSync(other.m_unmapSync) {
         other.m_address = MAP_FAILED;
     }
     MemoryMap& operator=(const MemoryMap& other) = delete;
@@ -105,6 +424,7 @@ public:
         m_size = other.m_size;
         m_address = other.m_address;
         m_fixed = other.m_fixed;
+        m_unmapSync = other.m_unmapSync;
         other.m_address = MAP_FAILED;
         return *this;
     }
@@ -124,20 +444,94 @@ public:
         if (msync(const_cast<void*>(m_address), m_size, flags) == -1)
             throw LastError();
     }
-    void resize(size_t size) {
-#if 0
-        void* addr = mremap(m_address, m_size, size,
-                            MREMAP_MAYMOVE | MREMAP_FIXED | MREMAP_DONTUNMAP, m_address);
-#else
-        void* addr = mremap(m_address, m_size, size, 0);
-#endif
-        if (addr == MAP_FAILED) {
+
+    // Range-limited sync(). The start is rounded down to the page boundary msync() requires.
+    void sync(size_t offset, size_t length, int flags = MS_SYNC)
+        requires Writable
+    {
+        size_t ps = pageSize();
+        size_t begin = offset - offset % ps;
+        size_t end = std::min(offset + std::min(length, m_size), m_size);
+        if (end <= begin)
+            return;
+        if (msync(reinterpret_cast<std::byte*>(const_cast<void*>(m_address)) + begin, end - begin,
+                  flags) == -1)
             throw LastError();
-        } else if (addr != m_address) {
-            // Unrecoverable
-            fprintf(stderr, "fatal: mremap() moved the mapping");
-            std::terminate();
+    }
+
+    // Sets the msync() flags used when unmapping, or 0 to skip the implicit sync entirely
+    void setUnmapSync(int flags)
+        requires Writable
+    {
+        m_unmapSync = flags;
+    }
+    // Grows a MAP_FIXED mapping in place by mapping only the pages after the current end, e.g.
+    // over the rest of a PROT_NONE reservation. Existing pages are left untouched so they stay
+    // resident. For file mappings, offset must be the file offset of address().
+    void extend(size_t size, int flags, int fd, off_t offset)
+        requires(!ProtNone)
+    {
+        assert(m_fixed);
+        size_t ps = pageSize();
+        size_t mappedEnd = ((m_size + ps - 1) / ps) * ps;
+        size_t newMappedEnd = ((size + ps - 1) / ps) * ps;
+        if (newMappedEnd > mappedEnd) {
+            void* tail = reinterpret_cast<std::byte*>(const_cast<void*>(m_address)) + mappedEnd;
+            if (mmap(tail, newMappedEnd - mappedEnd, MemoryProtection, flags | MAP_FIXED, fd,
+                     fd == -1 ? 0 : offset + off_t(mappedEnd)) == MAP_FAILED)
+                throw LastError();
         }
+        m_size = std::max(m_size, size);
+    }
+    // Shrinks a MAP_FIXED mapping in place, returning whole pages after the new end to the
+    // PROT_NONE reservation it was mapped over
+    void shrink(size_t size)
+        requires(!ProtNone)
+    {
+        assert(m_fixed && size > 0);
+        size_t ps = pageSize();
+        size_t mappedEnd = ((m_size + ps - 1) / ps) * ps;
+        size_t newMappedEnd = ((size + ps - 1) / ps) * ps;
+        if (newMappedEnd < mappedEnd) {
+            void* tail = reinterpret_cast<std::byte*>(const_cast<void*>(m_address)) + newMappedEnd;
+            if (mmap(tail, mappedEnd - newMappedEnd, PROT_NONE,
+                     MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0) == MAP_FAILED)
+                throw LastError();
+        }
+        m_size = std::min(m_size, size);
+    }
+    // Replaces the mapping in place with a different range of a file, e.g. to slide a window
+    // along it, reusing the same address range in a single mmap() call
+    void remap(int flags, int fd, off_t offset)
+        requires(!ProtNone)
+    {
+        if constexpr (Writable)
+            if (m_unmapSync)
+                sync(m_unmapSync);
+        if (mmap(const_cast<void*>(m_address), m_size, MemoryProtection, flags | MAP_FIXED, fd,
+                 offset) == MAP_FAILED)
+            throw LastError();
+    }
+    // Grows or shrinks the mapping without moving it, so pointers into it stay valid. A MAP_FIXED
+    // mapping over a PROT_NONE reservation maps or unmaps just its tail pages with one mmap().
+    // mremap() cannot do that in place because the reservation occupies the range it would grow
+    // into, and MREMAP_DONTUNMAP only moves same-sized mappings to a new address. Other mappings
+    // are grown with mremap() in place, which fails with ENOMEM if the following pages are in use.
+    void resize(size_t size, int flags, int fd, off_t offset)
+        requires(!ProtNone)
+    {
+        if (m_fixed) {
+            if (size >= m_size)
+                extend(size, flags, fd, offset);
+            else
+                shrink(size);
+            return;
+        }
+
+        // Without MREMAP_MAYMOVE the mapping is never moved
+        if (mremap(const_cast<void*>(m_address), m_size, size, 0) == MAP_FAILED)
+            throw LastError();
+        m_size = size;
     }
 
 private:
@@ -146,7 +540,8 @@ private:
             // Perhaps controversial to do unconditionally, but safer/less
             // surprising?
             if constexpr (Writable)
-                sync();
+                if (m_unmapSync)
+                    sync(m_unmapSync);
 
             // If the mapping was created with a specific address and MAP_FIXED,
             // restore the original mapping to PROT_NONE to keep the range
@@ -164,26 +559,334 @@ private:
     size_t       m_size = std::numeric_limits<size_t>::max();
     address_type m_address = nullptr;
     bool         m_fixed = false;
+    int          m_unmapSync = MS_SYNC | MS_INVALIDATE;
 };
 
 using MemoryMapRO = detail::MemoryMap<PROT_READ>;
 using MemoryMapRW = detail::MemoryMap<PROT_READ | PROT_WRITE>;
 
-template <bool Writable>
+// One large PROT_NONE reservation that resizable objects carve their own reservations from. Many
+// small reservations would each cost an mmap() call under the mm lock and a separate mapping
+// counted against vm.max_map_count, whereas free space here stays a single mapping. Must outlive
+// everything allocated from it.
+class AddressSpaceArena {
+public:
+    AddressSpaceArena(size_t size)
+        : m_reserved(nullptr, roundUp(size), MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)
+        , m_ranges(m_reserved.size()) {}
+    AddressSpaceArena(const AddressSpaceArena& other) = delete;
+    AddressSpaceArena& operator=(const AddressSpaceArena& other) = delete;
+
+    // Returns the address of size free bytes, or throws std::bad_alloc if the arena is full
+    void* allocate(size_t size, size_t alignment = pageSize()) {
+        uintptr_t base = reinterpret_cast<uintptr_t>(m_reserved.address());
+        return reinterpret_cast<void*>(
+            base + m_ranges.allocate(roundUp(size), std::max(alignment, size_t(pageSize())), base));
+    }
+
+    // Replaces anything still mapped in the range with PROT_NONE and returns it to the arena
+    void deallocate(void* address, size_t size) {
+        size = roundUp(size);
+        // MAP_NORESERVE matches the original reservation so the kernel merges them again
+        if (mmap(address, size, PROT_NONE, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                 -1, 0) == MAP_FAILED)
+            LastError().print(); // called from destructors. leak the range
+        else
+            m_ranges.deallocate(uintptr_t(address) - uintptr_t(m_reserved.address()), size);
+    }
+    void*  address() const { return m_reserved.address(); }
+    size_t size() const { return m_reserved.size(); }
+    size_t available() const { return m_ranges.available(); }
+
+private:
+    static size_t roundUp(size_t size) {
+        size_t ps = pageSize();
+        return (std::max(size, size_t(1)) + ps - 1) / ps * ps;
+    }
+    detail::MemoryMap<PROT_NONE> m_reserved;
+    RangeAllocator               m_ranges;
+};
+
+// A PROT_NONE address range to map into with MAP_FIXED, either reserved separately or carved from
+// an AddressSpaceArena
+class Reservation {
+public:
+    explicit Reservation(size_t size)
+        : m_own(std::in_place, nullptr, size, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)
+        , m_address(m_own->address())
+        , m_size(size) {}
+    Reservation(AddressSpaceArena& arena, size_t size, size_t alignment = pageSize())
+        : m_arena(&arena)
+        , m_address(arena.allocate(size, alignment))
+        , m_size(size) {}
+    Reservation(const Reservation& other) = delete;
+    Reservation(Reservation&& other) noexcept
+        : m_own(std::move(other.m_own))
+        , m_arena(std::exchange(other.m_arena, nullptr))
+        , m_address(std::exchange(other.m_address, nullptr))
+        , m_size(other.m_size) {}
+    Reservation& operator=(const Reservation& other) = delete;
+    Reservation& operator=(Reservation&& other) noexcept {
+        release();
+        m_own = std::move(other.m_own);
+        m_arena = std::exchange(other.m_arena, nullptr);
+        m_address = std::exchange(other.m_address, nullptr);
+        m_size = other.m_size;
+        return *this;
+    }
+    ~Reservation() { release(); }
+    void*  address() const { return m_address; }
+    size_t size() const { return m_size; }
+
+private:
+    void release() {
+        if (m_arena && m_address)
+            m_arena->deallocate(m_address, m_size);
+    }
+    std::optional<detail::MemoryMap<PROT_NONE>> m_own;
+    AddressSpaceArena*                          m_arena = nullptr;
+    void*                                       m_address = nullptr;
+    size_t                                      m_size = 0;
+};
+
+// Policy options are resolved to open() and mmap() flags at compile time. Read-only mappings are
+// always MAP_PRIVATE, which is equivalent when nothing writes through them.
+template <bool Writable, file_policy Policy = file_policy{}>
 class MappedFile {
+    static_assert(Policy.pages == page_size::normal || Policy.pages == page_size::transparent_huge,
+                  "explicit huge pages cannot back regular files");
+    static constexpr bool WritesFile = Writable && Policy.share == sharing::shared;
+    static constexpr int  OpenFlags = WritesFile ? O_RDWR : O_RDONLY;
+
 public:
     using data_type = std::conditional_t<Writable, void*, const void*>;
-    MappedFile(const fs::path& path, int mapFlags = MAP_PRIVATE)
-        : m_file(path, Writable ? O_RDWR : O_RDONLY)
-        , m_mapped(nullptr, m_file.size(), mapFlags, m_file, 0) {}
+    static constexpr int DefaultMapFlags =
+        (WritesFile ? MAP_SHARED : MAP_PRIVATE) | (Policy.populate ? MAP_POPULATE : 0);
+    MappedFile(const fs::path& path, int mapFlags = DefaultMapFlags)
+        : m_file(path, OpenFlags)
+        , m_mapped(nullptr, m_file.size(), mapFlags, m_file, 0) {
+        applyPolicy();
+    }
+    MappedFile(const fs::path& path, durability mode, int mapFlags = DefaultMapFlags)
+        requires Writable
+        : MappedFile(path, mapFlags) {
+        m_mapped.setUnmapSync(closeSyncFlags(mode));
+    }
+
+    // Maps only [offset, offset + length) of the file, clamped to its end. The mapping starts at
+    // the page boundary before offset but data() points at the exact byte.
+    MappedFile(const fs::path& path, size_t offset, size_t length, int mapFlags = DefaultMapFlags)
+        : m_file(path, OpenFlags)
+        , m_offset(offset)
+        , m_delta(offset % pageSize())
+        , m_mapped(nullptr, rangeSize(m_file.size(), offset, length) + m_delta, mapFlags, m_file,
+                   off_t(offset - m_delta)) {
+        applyPolicy();
+    }
+
+    // Synchronously prefaulting the whole file is just MAP_POPULATE
+    MappedFile(const fs::path& path, prefault populate, int mapFlags = DefaultMapFlags)
+        : m_file(path, OpenFlags)
+        , m_mapped(nullptr, m_file.size(),
+                   mapFlags | (populateAll(populate, m_file.size()) ? MAP_POPULATE : 0), m_file,
+                   0) {
+        applyPolicy();
+        if (populate.background) {
+            m_prefaulter = std::jthread([address = data(), size = size(),
+                                         populate](std::stop_token stop) {
+                try {
+                    prefaultRange(address, size, populate.offset, populate.length, stop);
+                } catch (const mapping_error& e) {
+                    e.print(); // nowhere to throw to. it was only a hint anyway
+                }
+            });
+        } else if (!populateAll(populate, size())) {
+            prefaultRange(data(), size(), populate.offset, populate.length);
+        }
+    }
+    MappedFile(MappedFile&& other) noexcept = default;
+    ~MappedFile() { stopPrefault(); }
+
+    // m_prefaulter is declared first so it is stopped before the mapping is replaced
+    MappedFile& operator=(MappedFile&& other) noexcept = default;
+
+    data_type data() const {
+        return reinterpret_cast<std::conditional_t<Writable, std::byte*, const std::byte*>>(
+                   m_mapped.address()) +
+               m_delta;
+    }
+    size_t size() const { return m_mapped.size() - m_delta; }
 
-    data_type data() const { return m_mapped.address(); }
-    size_t    size() const { return m_mapped.size(); }
+    // File offset of data()
+    size_t offset() const { return m_offset; }
+    void   advise(size_t offset, size_t length, access_pattern pattern) const {
+        adviseRange(m_mapped.address(), m_mapped.size(), offset + m_delta, length, pattern);
+    }
+
+    // Keeps [offset, offset + length) in memory, e.g. for latency critical tables. See
+    // lockRange(). Pages are unlocked when unmapped.
+    void lock(size_t offset, size_t length) const {
+        lockRange(m_mapped.address(), m_mapped.size(), offset + m_delta, length);
+    }
+    void unlock(size_t offset, size_t length) const {
+        unlockRange(m_mapped.address(), m_mapped.size(), offset + m_delta, length);
+    }
+    const FileDescriptor& nativeFile() const { return m_file; }
+    mapping_stats         stats() const {
+        return m_stats.snapshot(residentBytes(m_mapped.address(), m_mapped.size()), size(),
+                                m_mapped.size());
+    }
+
+    // Synchronously writes back dirty pages in the given range
+    void flush(size_t offset, size_t length)
+        requires Writable
+    {
+        ScopedTimer timer(m_stats.syncs);
+        m_mapped.sync(offset + m_delta, length);
+    }
+    void flush()
+        requires Writable
+    {
+        flush(0, size());
+    }
+
+    // Opt-in dirty tracking. Records that [offset, offset + length) was modified, clamped to
+    // size(), so flush_dirty() writes back only what changed. Thread safe.
+    void mark_dirty(size_t offset, size_t length)
+        requires Writable
+    {
+        offset = std::min(offset, size());
+        m_dirty.mark(offset, std::min(length, size() - offset));
+    }
+
+    // Ranges marked since the last flush_dirty()
+    std::vector<dirty_range> dirty_ranges() const
+        requires Writable
+    {
+        return m_dirty.ranges();
+    }
+
+    // Synchronously writes back just the marked ranges and returns them, e.g. to send the same
+    // bytes to a replica as a delta. The ranges are marked again if writing back fails.
+    std::vector<dirty_range> flush_dirty()
+        requires Writable
+    {
+        std::vector<dirty_range> ranges = m_dirty.take();
+        ScopedTimer              timer(m_stats.syncs);
+        try {
+            for (const dirty_range& range : ranges)
+                m_mapped.sync(range.offset + m_delta, range.length);
+        } catch (...) {
+            for (const dirty_range& range : ranges)
+                m_dirty.mark(range.offset, range.length);
+            throw;
+        }
+        return ranges;
+    }
+
+    // Returns a read-only mapping of a point in time copy of this mapping's range, written to a
+    // new file at path. Later writes to either file are not visible in the other. See
+    // cloneRange() for the cost.
+    MappedFile<false> snapshot(const fs::path& path) const
+        requires Writable
+    {
+        cloneRange(m_file, m_offset, size(), path);
+        return MappedFile<false>(path);
+    }
 
 private:
-    static constexpr int MapMemoryProtection = Writable ? PROT_READ : PROT_READ | PROT_WRITE;
+    void applyPolicy() {
+        if constexpr (Policy.pages == page_size::transparent_huge)
+            (void)madvise(const_cast<void*>(m_mapped.address()), m_mapped.size(),
+                          MADV_HUGEPAGE); // only a hint
+        if constexpr (Writable)
+            m_mapped.setUnmapSync(WritesFile ? closeSyncFlags(Policy.sync) : 0);
+    }
+    static bool populateAll(const prefault& populate, size_t size) {
+        return !populate.background && populate.offset == 0 && populate.length >= size;
+    }
+    static size_t rangeSize(size_t fileSize, size_t offset, size_t length) {
+        return offset < fileSize ? std::min(length, fileSize - offset) : 0;
+    }
+    void stopPrefault() {
+        if (m_prefaulter.joinable()) {
+            m_prefaulter.request_stop();
+            m_prefaulter.join();
+        }
+    }
+    static constexpr int MapMemoryProtection = Writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    std::jthread         m_prefaulter;
     FileDescriptor       m_file;
+    size_t               m_offset = 0;
+    size_t               m_delta = 0; // from the page aligned start of the mapping to data()
     MemoryMap<MapMemoryProtection> m_mapped;
+    OperationStats                 m_stats;
+    DirtyRanges                    m_dirty;
+};
+
+// Read-only mapping of a fixed size window of a file, which can be moved along the file with
+// seek(). Use this instead of MappedFile when the whole file doesn't fit in the address space.
+class MappedWindow {
+public:
+    MappedWindow(const fs::path& path, size_t windowSize, size_t offset = 0)
+        : m_file(path, O_RDONLY)
+        , m_fileSize(m_file.size())
+        , m_windowSize(windowSize)
+        , m_offset(offset)
+        , m_mappedOffset(alignDown(offset))
+        , m_mapped(nullptr, mappingSize(windowSize), MAP_PRIVATE, m_file, off_t(m_mappedOffset)) {}
+    // nullptr for an empty file, matching Windows where it cannot be mapped
+    const void* data() const {
+        if (m_fileSize == 0)
+            return nullptr;
+        return reinterpret_cast<const std::byte*>(m_mapped.address()) + (m_offset - m_mappedOffset);
+    }
+    size_t size() const {
+        return m_offset < m_fileSize ? std::min(m_windowSize, m_fileSize - m_offset) : 0;
+    }
+    size_t offset() const { return m_offset; }
+    size_t fileSize() const { return m_fileSize; }
+
+    // Moves the window to start at the given file offset. This is free while the window stays
+    // within the currently mapped range, otherwise the mapping is replaced in place.
+    void seek(size_t offset) {
+        // Nothing of an empty file can be read, so there is no need to move the mapping
+        if (m_fileSize &&
+            (offset < m_mappedOffset || offset + m_windowSize > m_mappedOffset + m_mapped.size())) {
+            ScopedTimer timer(m_stats.remaps);
+            size_t      mappedOffset = alignDown(offset);
+            m_mapped.remap(MAP_PRIVATE, m_file, off_t(mappedOffset));
+            m_mappedOffset = mappedOffset;
+        }
+        m_offset = offset;
+    }
+    // Advises the part of [offset, offset + length) of the window that is within the file.
+    // madvise() needs a page aligned start, so this is relative to the aligned mapping.
+    void advise(size_t offset, size_t length, access_pattern pattern) const {
+        offset = std::min(offset, size());
+        adviseRange(m_mapped.address(), m_mapped.size(), offset + (m_offset - m_mappedOffset),
+                    std::min(length, size() - offset), pattern);
+    }
+    mapping_stats stats() const {
+        return m_stats.snapshot(residentBytes(m_mapped.address(), m_mapped.size()),
+                                m_mapped.size(), m_mapped.size());
+    }
+
+private:
+    static size_t alignDown(size_t offset) { return offset - offset % pageSize(); }
+
+    // Leave room for the window to start anywhere in the first page
+    static size_t mappingSize(size_t windowSize) {
+        size_t ps = pageSize();
+        return ((windowSize + ps - 1) / ps + 1) * ps;
+    }
+    FileDescriptor      m_file;
+    size_t              m_fileSize;
+    size_t              m_windowSize;
+    size_t              m_offset;
+    size_t              m_mappedOffset;
+    detail::MemoryMapRO m_mapped;
+    OperationStats      m_stats;
 };
 
 class ResizableMappedFile {
@@ -191,47 +894,235 @@ public:
     ResizableMappedFile() = delete;
     ResizableMappedFile(const ResizableMappedFile& other) = delete;
     ResizableMappedFile(ResizableMappedFile&& other) noexcept = default;
-    ResizableMappedFile(const fs::path& path, size_t maxSize)
-        : m_reserved(nullptr, maxSize, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)
-        , m_file(path, O_CREAT | O_RDWR, 0666) {
-        size_t size = throwIfAbove(m_file.size(), m_reserved.size());
-        if (size)
-            map(size);
-    }
+    ResizableMappedFile(const fs::path& path, size_t maxSize,
+                        growth_policy growth = growth_policy::exact(),
+                        durability    mode = durability::sync_on_close)
+        : ResizableMappedFile(Reservation(maxSize), path, growth, mode) {}
+
+    // Reserves maxSize bytes of address space from arena rather than separately
+    ResizableMappedFile(AddressSpaceArena& arena, const fs::path& path, size_t maxSize,
+                        growth_policy growth = growth_policy::exact(),
+                        durability    mode = durability::sync_on_close)
+        : ResizableMappedFile(Reservation(arena, maxSize), path, growth, mode) {}
+    ~ResizableMappedFile() { trim(); }
     ResizableMappedFile& operator=(const ResizableMappedFile& other) = delete;
     void*                data() const { return m_mapped ? m_mapped->address() : nullptr; }
-    size_t               size() const { return m_mapped ? m_mapped->size() : 0; }
+    size_t               size() const { return m_size; }
     size_t               capacity() const { return m_reserved.size(); }
     void                 resize(size_t size) {
+        ScopedTimer timer(m_stats.resizes);
         size = throwIfAbove(size, m_reserved.size());
-        m_mapped.reset();
-        m_file.truncate(size);
-        if (size)
-            map(size);
+        if (m_mapped && (m_durability == durability::sync || m_durability == durability::async)) {
+            ScopedTimer syncTimer(m_stats.syncs);
+            m_mapped->sync(0, m_size, m_durability == durability::sync ? MS_SYNC : MS_ASYNC);
+        }
+
+        // Note: the file is only grown here. Truncation is deferred until the object is destroyed
+        // so pages stay mapped and shrinking then growing again is cheap.
+        if (size > m_fileSize)
+            grow(size);
+        m_size = size;
+        if (m_committed > size)
+            std::atomic_ref(m_committed).store(size, std::memory_order_relaxed);
+    }
+
+    // Thread safe, lock free append. Atomically reserves bytes at the end of size() and returns a
+    // pointer to them that stays valid for the object's lifetime. The file is grown by one thread
+    // while others crossing the same boundary wait, so use a growth_policy that grows in chunks.
+    // Must not be called concurrently with other non-const methods, e.g. resize().
+    // If growing fails, e.g. with ENOSPC from fallocate(), the exception is rethrown and size() is
+    // restored. If other threads appended meanwhile it can't be, and size() stays past the end of
+    // the backed range, so only access what earlier calls returned and resize() back to a known
+    // size before continuing.
+    void* reserve_append(size_t bytes) {
+        size_t offset = bumpShared(m_size, bytes, m_reserved.size());
+        try {
+            growShared(m_fileSize, m_growing, offset + bytes, [this](size_t end) { grow(end); });
+        } catch (...) {
+            unbumpShared(m_size, offset, bytes);
+            throw;
+        }
+        return static_cast<std::byte*>(m_reserved.address()) + offset;
+    }
+
+    // Publishes that the first length bytes, clamped to size(), are fully written, e.g. after
+    // appending a record. Concurrent readers that see the length from committed() can read that
+    // many bytes from data() without locks. Thread safe, including with reserve_append(), but it
+    // never lowers the committed length, so callers must only commit a fully written prefix.
+    void commit(size_t length) {
+        publishShared(m_committed,
+                      std::min(length, std::atomic_ref(m_size).load(std::memory_order_relaxed)));
+    }
+
+    // Length last published by commit(), loaded with acquire ordering so that many bytes from
+    // data() are safe to read from any thread. data() does not change once anything is
+    // committed. Shrinking with resize() lowers it, which is not safe with concurrent readers.
+    size_t committed() const { return loadPublished(m_committed); }
+
+    // Copies length bytes from source to offset, growing size() first if needed. Whole pages are
+    // written with pwrite() instead of through the mapping. The page cache is shared, so they
+    // appear in the mapping, but pages not faulted in yet are filled directly rather than zeroed
+    // or read on the first touch only to be overwritten.
+    void write(size_t offset, const void* source, size_t length) {
+        if (length == 0)
+            return;
+        if (offset > m_reserved.size() || length > m_reserved.size() - offset)
+            throw std::bad_alloc();
+        if (offset + length > m_size)
+            resize(offset + length);
+        auto*  bytes = static_cast<const std::byte*>(source);
+        auto*  target = static_cast<std::byte*>(data());
+        size_t ps = pageSize();
+        size_t end = offset + length;
+        size_t pagesBegin = std::min((offset + ps - 1) / ps * ps, end);
+        size_t pagesEnd = std::max(end / ps * ps, pagesBegin);
+        memcpy(target + offset, bytes, pagesBegin - offset);
+        m_file.write(pagesBegin, bytes + (pagesBegin - offset), pagesEnd - pagesBegin);
+        memcpy(target + pagesEnd, bytes + (pagesEnd - offset), end - pagesEnd);
+    }
+
+    // Synchronously writes back dirty pages in the given range
+    void flush(size_t offset, size_t length) {
+        if (m_mapped) {
+            ScopedTimer timer(m_stats.syncs);
+            m_mapped->sync(offset, std::min(length, m_size - std::min(offset, m_size)));
+        }
+    }
+    void flush() { flush(0, m_size); }
+
+    // Opt-in dirty tracking. Records that [offset, offset + length) was modified, clamped to
+    // size(), so flush_dirty() writes back only what changed. Thread safe, including with
+    // reserve_append().
+    void mark_dirty(size_t offset, size_t length) {
+        size_t size = std::atomic_ref(m_size).load(std::memory_order_relaxed);
+        offset = std::min(offset, size);
+        m_dirty.mark(offset, std::min(length, size - offset));
+    }
+
+    // Ranges marked since the last flush_dirty()
+    std::vector<dirty_range> dirty_ranges() const { return m_dirty.ranges(); }
+
+    // Synchronously writes back just the marked ranges and returns them, e.g. to send the same
+    // bytes to a replica as a delta. The ranges are marked again if writing back fails.
+    std::vector<dirty_range> flush_dirty() {
+        std::vector<dirty_range> ranges = m_dirty.take();
+        if (!m_mapped)
+            return ranges;
+        ScopedTimer timer(m_stats.syncs);
+        try {
+            for (const dirty_range& range : ranges)
+                m_mapped->sync(range.offset, range.length);
+        } catch (...) {
+            for (const dirty_range& range : ranges)
+                m_dirty.mark(range.offset, range.length);
+            throw;
+        }
+        return ranges;
+    }
+
+    // Returns a read-only mapping of a point in time copy of size() bytes, written to a new file
+    // at path while this file stays writable. See cloneRange() for the cost. Not thread safe with
+    // concurrent writes to the mapping or reserve_append() calls.
+    MappedFile<false> snapshot(const fs::path& path) const {
+        cloneRange(m_file, 0, m_size, path);
+        return MappedFile<false>(path);
+    }
+
+    void advise(size_t offset, size_t length, access_pattern pattern) const {
+        adviseRange(data(), m_size, offset, length, pattern);
+    }
+
+    // Keeps [offset, offset + length) of size() in memory. See lockRange().
+    void lock(size_t offset, size_t length) const { lockRange(data(), m_size, offset, length); }
+    void unlock(size_t offset, size_t length) const { unlockRange(data(), m_size, offset, length); }
+    const FileDescriptor& nativeFile() const { return m_file; }
+
+    // Not thread safe with concurrent reserve_append() calls
+    mapping_stats stats() const {
+        return m_stats.snapshot(m_mapped ? residentBytes(data(), m_fileSize) : 0, m_fileSize,
+                                m_reserved.size());
     }
 
     // Override default move assignment so m_reserved outlives m_mapped
     ResizableMappedFile& operator=(ResizableMappedFile&& other) noexcept {
+        trim();
         m_mapped = std::move(other.m_mapped);
         m_file = std::move(other.m_file);
         m_reserved = std::move(other.m_reserved);
+        m_growth = other.m_growth;
+        m_durability = other.m_durability;
+        m_size = other.m_size;
+        m_fileSize = other.m_fileSize;
+        m_committed = other.m_committed;
+        m_growing = false;
+        m_stats = other.m_stats;
+        m_dirty = std::move(other.m_dirty);
         return *this;
     }
 
 private:
+    ResizableMappedFile(Reservation&& reserved, const fs::path& path, growth_policy growth,
+                        durability mode)
+        : m_reserved(std::move(reserved))
+        , m_file(path, O_CREAT | O_RDWR, 0666)
+        , m_growth(growth)
+        , m_durability(mode) {
+        m_size = m_fileSize = throwIfAbove(m_file.size(), m_reserved.size());
+        if (m_fileSize)
+            map(m_fileSize);
+    }
+    void grow(size_t size) {
+        size_t fileSize = m_growth(m_fileSize, size, m_reserved.size());
+        if (m_growth.preallocate)
+            m_file.allocate(fileSize);
+        else
+            m_file.truncate(fileSize);
+        map(fileSize);
+
+        // Publishes the new pages to reserve_append() callers
+        std::atomic_ref(m_fileSize).store(fileSize, std::memory_order_release);
+    }
     void map(size_t size) {
-        // TODO: if m_mapped shrinks, does m_reserved instead need to be
-        // recreated to fill the gap?
-        m_mapped.emplace(m_reserved.address(), size, MAP_FIXED | MAP_SHARED_VALIDATE, m_file, 0);
+        ScopedTimer timer(m_stats.remaps);
+
+        // Only map the new tail pages. Remapping the whole range would drop the page table
+        // entries of everything already written.
+        if (m_mapped) {
+            m_mapped->resize(size, MAP_SHARED_VALIDATE, m_file, 0);
+        } else {
+            m_mapped.emplace(m_reserved.address(), size, MAP_FIXED | MAP_SHARED_VALIDATE, m_file,
+                             0);
+            m_mapped->setUnmapSync(closeSyncFlags(m_durability));
+        }
+    }
+
+    // Truncate the file to the last size requested, removing any space added by the growth policy
+    // or left behind by shrinking
+    void trim() {
+        if (m_file != -1 && m_fileSize != m_size) {
+            // Unmap the file before truncating the file
+            m_mapped.reset();
+            if (ftruncate(m_file, m_size) == -1)
+                LastError().print(); // can't throw from destructor. ignore the error
+            m_fileSize = m_size;
+        }
     }
     static size_t throwIfAbove(size_t v, size_t limit) {
         if (v > limit)
             throw std::bad_alloc();
         return v;
     }
-    detail::MemoryMap<PROT_NONE>       m_reserved;
+    Reservation                        m_reserved;
     FileDescriptor                     m_file;
     std::optional<detail::MemoryMapRW> m_mapped;
+    growth_policy                      m_growth;
+    durability                         m_durability;
+    size_t                             m_size = 0;
+    size_t                             m_fileSize = 0;
+    size_t                             m_committed = 0;
+    bool                               m_growing = false;
+    OperationStats                     m_stats;
+    DirtyRanges                        m_dirty;
 };
 
 static_assert(std::is_move_constructible_v<ResizableMappedFile>);
@@ -242,80 +1133,496 @@ public:
     ResizableMappedMemory() = delete;
     ResizableMappedMemory(const ResizableMappedMemory& other) = delete;
     ResizableMappedMemory(ResizableMappedMemory&& other) noexcept = default;
-    ResizableMappedMemory(size_t initialSize, size_t maxSize)
-        : m_reserved(nullptr, maxSize, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0) {
-        if (initialSize)
-            map(initialSize);
-    }
+    // Shrinking releases memory above the new size, except for up to releaseThreshold bytes that
+    // are kept committed so oscillating sizes don't repeatedly map and unmap the same pages
+    ResizableMappedMemory(size_t initialSize, size_t maxSize, page_size pages = page_size::normal,
+                          size_t releaseThreshold = 0, numa_placement placement = {})
+        : ResizableMappedMemory(Reservation(reservationSize(maxSize, pageGranularity(pages))),
+                                initialSize, maxSize, pages, releaseThreshold, placement) {}
+
+    // Reserves maxSize bytes of address space from arena rather than separately
+    ResizableMappedMemory(AddressSpaceArena& arena, size_t initialSize, size_t maxSize,
+                          page_size pages = page_size::normal, size_t releaseThreshold = 0,
+                          numa_placement placement = {})
+        : ResizableMappedMemory(Reservation(arena, arenaReservationSize(maxSize, pages),
+                                            pageGranularity(pages)),
+                                initialSize, maxSize, pages, releaseThreshold, placement) {}
     ResizableMappedMemory& operator=(const ResizableMappedMemory& other) = delete;
-    void*                  data() const { return m_size ? m_reserved.address() : nullptr; }
+    void*                  data() const { return m_size ? m_address : nullptr; }
     size_t                 size() const { return m_size; }
-    size_t                 capacity() const { return m_reserved.size(); }
+    size_t                 capacity() const { return m_capacity; }
     void                   resize(size_t size) {
-        size = throwIfAbove(size, m_reserved.size());
-        if (size)
+        ScopedTimer timer(m_stats.resizes);
+        size = throwIfAbove(size, m_capacity);
+        if (size > m_size)
             map(size);
+        else
+            release(size);
+    }
+    void advise(size_t offset, size_t length, access_pattern pattern) const {
+        adviseRange(m_address, m_size, offset, length, pattern);
+    }
+
+    // Keeps [offset, offset + length) in memory. See lockRange(). If the range reaches size(),
+    // e.g. lock(0, capacity()), pages committed by later resize() calls are locked too, until a
+    // range reaching size() is unlocked. Released pages are unlocked.
+    void lock(size_t offset, size_t length) {
+        bool toEnd = length >= m_size - std::min(offset, m_size);
+        lockRange(m_address, toEnd ? m_mappedSize : m_size, offset, length);
+        m_lockGrowth = m_lockGrowth || toEnd;
+    }
+    void unlock(size_t offset, size_t length) {
+        bool toEnd = length >= m_size - std::min(offset, m_size);
+        unlockRange(m_address, toEnd ? m_mappedSize : m_size, offset, length);
+        m_lockGrowth = m_lockGrowth && !toEnd;
+    }
+    mapping_stats stats() const {
+        return m_stats.snapshot(residentBytes(m_address, m_mappedSize), m_mappedSize,
+                                m_reserved.size());
     }
 
     ResizableMappedMemory& operator=(ResizableMappedMemory&& other) noexcept = default;
 
 private:
+    ResizableMappedMemory(Reservation&& reserved, size_t initialSize, size_t maxSize,
+                          page_size pages, size_t releaseThreshold, numa_placement placement)
+        : m_pages(pages)
+        , m_placement(placement)
+        , m_granularity(pageGranularity(pages))
+        , m_reserved(std::move(reserved))
+        , m_address(alignUp(m_reserved.address(), m_granularity))
+        , m_capacity(maxSize)
+        , m_releaseThreshold(releaseThreshold) {
+        if (initialSize)
+            map(initialSize);
+    }
     void map(size_t size) {
-        // TODO: if m_mapped shrinks, does m_reserved instead need to be
-        // recreated to fill the gap?
-        size_t ps = pageSize();
-        size_t mappedSize = ((size + ps - 1) / ps) * ps; // TODO: cache?
-        if (mappedSize == 0) {
-            if (mmap(const_cast<void*>(m_reserved.address()), mappedSize, PROT_READ | PROT_WRITE,
-                     MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) == MAP_FAILED)
+        // Map only the additional pages over the reservation, as MemoryMap::resize() does.
+        // Remapping existing pages would zero them.
+        size_t mappedSize = roundUp(size);
+        if (mappedSize > m_mappedSize) {
+            ScopedTimer timer(m_stats.remaps);
+            void*       tail = reinterpret_cast<void*>(uintptr_t(m_address) + m_mappedSize);
+            if (mmap(tail, mappedSize - m_mappedSize, PROT_READ | PROT_WRITE,
+                     MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS | pageMapFlags(m_pages), -1,
+                     0) == MAP_FAILED)
                 throw LastError();
-        } else {
-#if 1
-            // Map any additional pages needed. Don't remap existing pages or
-            // they get zeroed. Another idea might be a memory fd.
-            if (mappedSize > m_mappedSize) {
-                if (mmap(reinterpret_cast<void*>(uintptr_t(m_reserved.address()) + m_mappedSize),
-                         mappedSize - m_mappedSize, PROT_READ | PROT_WRITE,
-                         MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) == MAP_FAILED)
-                    throw LastError();
-                m_mappedSize = mappedSize;
-            }
-#else
-    #if 1
-            // Remap? Specs say old and new addresses cannot be the same,
-            // although it only errors out when remapping more than a page.
-            void* addr =
-                mremap(m_reserved.address(), m_size, size,
-                       MREMAP_MAYMOVE | MREMAP_FIXED | MREMAP_DONTUNMAP, m_reserved.address());
-    #else
-            // Remap without MREMAP_FIXED - immediately fails because it can't
-            // replace the reserved mapping.
-            void* addr = mremap(m_reserved.address(), m_size, size, 0);
-    #endif
-            if (addr == MAP_FAILED) {
+
+            // Ignore failure, e.g. EINVAL if the kernel has no THP support. It's only a hint.
+            if (m_pages == page_size::transparent_huge)
+                (void)madvise(tail, mappedSize - m_mappedSize, MADV_HUGEPAGE);
+            placeRange(tail, mappedSize - m_mappedSize, m_placement);
+            if (m_lockGrowth)
+                lockRange(tail, mappedSize - m_mappedSize, 0, mappedSize - m_mappedSize);
+            m_mappedSize = mappedSize;
+        }
+        m_size = size;
+    }
+    // Return committed pages above size + m_releaseThreshold to the reservation. Remapping
+    // PROT_NONE frees the memory and keeps the range reserved for map() to grow into again.
+    void release(size_t size) {
+        size_t keep = roundUp(size + std::min(m_releaseThreshold, m_capacity - size));
+        if (keep < m_mappedSize) {
+            ScopedTimer timer(m_stats.remaps);
+            if (mmap(reinterpret_cast<void*>(uintptr_t(m_address) + keep), m_mappedSize - keep,
+                     PROT_NONE, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1,
+                     0) == MAP_FAILED)
                 throw LastError();
-            } else if (addr != m_reserved.address()) {
-                // Unrecoverable
-                fprintf(stderr, "fatal: mremap() moved the mapping");
-                std::terminate();
-            }
-#endif
+            m_mappedSize = keep;
         }
         m_size = size;
     }
+    size_t roundUp(size_t size) const {
+        return ((size + m_granularity - 1) / m_granularity) * m_granularity;
+    }
     static size_t throwIfAbove(size_t v, size_t limit) {
         if (v > limit)
             throw std::bad_alloc();
         return v;
     }
-    detail::MemoryMap<PROT_NONE> m_reserved;
+
+    // Huge pages need an aligned address, so reserve enough extra to align the start
+    static size_t reservationSize(size_t maxSize, size_t granularity) {
+        if (granularity == size_t(pageSize()))
+            return maxSize;
+        return ((maxSize + granularity - 1) / granularity + 1) * granularity;
+    }
+    // Arena slots are allocated aligned, but map() commits whole granules, so the slot must cover
+    // the last one or it would be mapped over the next allocation
+    static size_t arenaReservationSize(size_t maxSize, page_size pages) {
+        size_t granularity = pageGranularity(pages);
+        return (maxSize + granularity - 1) / granularity * granularity;
+    }
+    static void* alignUp(void* address, size_t alignment) {
+        return reinterpret_cast<void*>((uintptr_t(address) + alignment - 1) & ~(alignment - 1));
+    }
+    page_size                    m_pages;
+    numa_placement               m_placement;
+    size_t                       m_granularity;
+    Reservation                  m_reserved;
+    void*                        m_address;
+    size_t                       m_capacity;
+    size_t                       m_releaseThreshold;
     size_t                       m_size = 0;
     size_t                       m_mappedSize = 0;
+    bool                         m_lockGrowth = false;
+    OperationStats               m_stats;
 };
 
 static_assert(std::is_move_constructible_v<ResizableMappedMemory>);
 static_assert(std::is_move_assignable_v<ResizableMappedMemory>);
 
+// Growable buffer for writing large files once without polluting the page cache. Writes go to a
+// ResizableMappedMemory. Each resize() hands the chunks wholly below the previous size() to a
+// background thread that writes them to the file with O_DIRECT and then discards their memory,
+// so data must be written before calling resize() again. Written chunks read back as zeros and
+// size() cannot be reduced below them. The rest is written and the file truncated to size() when
+// the object is destroyed. Filesystems without O_DIRECT, e.g. tmpfs, fall back to buffered writes
+// that drop their pages from the cache once written.
+class StreamingFile {
+public:
+    StreamingFile() = delete;
+    StreamingFile(const StreamingFile& other) = delete;
+    StreamingFile(StreamingFile&& other) noexcept = default;
+    StreamingFile(const fs::path& path, size_t maxSize, size_t chunkSize = 8 * 1024 * 1024)
+        : m_memory(0, maxSize)
+        , m_chunkSize(std::max(size_t(pageSize()), chunkSize - chunkSize % pageSize()))
+        , m_writer(std::make_unique<Writer>(path)) {}
+    ~StreamingFile() { finish(); }
+    StreamingFile& operator=(const StreamingFile& other) = delete;
+    StreamingFile& operator=(StreamingFile&& other) noexcept {
+        finish();
+        m_writer = std::move(other.m_writer);
+        m_memory = std::move(other.m_memory);
+        m_chunkSize = other.m_chunkSize;
+        return *this;
+    }
+    void*  data() const { return m_memory.data(); }
+    size_t size() const { return m_memory.size(); }
+    size_t capacity() const { return m_memory.capacity(); }
+
+    // Throws any error from writing previous chunks
+    void resize(size_t size) {
+        std::unique_lock lock(m_writer->mutex);
+        m_writer->rethrow();
+        if (size < m_writer->requested)
+            throw mapping_error("cannot shrink a streaming_file below data already written");
+        size_t complete = (m_memory.size() / m_chunkSize) * m_chunkSize;
+        lock.unlock();
+        m_memory.resize(size);
+        m_writer->request(m_memory.data(), std::min(complete, (size / m_chunkSize) * m_chunkSize));
+    }
+
+    // Waits for all complete chunks to be written
+    void flush() { m_writer->wait(); }
+
+private:
+    struct Writer {
+        Writer(const fs::path& path)
+            : file(open(path))
+            , direct((fcntl(file, F_GETFL) & O_DIRECT) != 0) {}
+
+        static FileDescriptor open(const fs::path& path) {
+            int flags = O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC;
+            int fd = ::open(path.c_str(), flags | O_DIRECT, 0666);
+            if (fd == -1 && errno == EINVAL)
+                fd = ::open(path.c_str(), flags, 0666);
+            if (fd == -1)
+                throw LastMappedFileError(path);
+            return FileDescriptor(fd);
+        }
+
+        // Writes [offset, offset + length) of the buffer at the same file offset
+        void write(const std::byte* buffer, size_t offset, size_t length) {
+            const std::byte* bytes = buffer + offset;
+            size_t           end = offset + length;
+            while (offset < end) {
+                ssize_t written = pwrite(file, bytes, end - offset, off_t(offset));
+                if (written == -1) {
+                    if (errno == EINTR)
+                        continue;
+                    throw LastError();
+                }
+                bytes += written;
+                offset += size_t(written);
+            }
+            if (!direct) {
+                // Buffered fallback. Write back and drop the pages rather than keep them cached.
+                (void)sync_file_range(file, off_t(end - length), off_t(length),
+                                      SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                                          SYNC_FILE_RANGE_WAIT_AFTER);
+                (void)posix_fadvise(file, off_t(end - length), off_t(length),
+                                    POSIX_FADV_DONTNEED);
+            }
+        }
+
+        // Queues chunks up to end to be written in the background
+        void request(void* buffer, size_t end) {
+            {
+                std::lock_guard lock(mutex);
+                if (end <= requested)
+                    return;
+                base = static_cast<std::byte*>(buffer);
+                requested = end;
+            }
+            if (!worker.joinable())
+                worker = std::jthread([this](std::stop_token stop) { run(stop); });
+            wake.notify_one();
+        }
+
+        void wait() {
+            std::unique_lock lock(mutex);
+            done.wait(lock, [this] { return written == requested; });
+            rethrow();
+        }
+
+        void rethrow() {
+            if (error)
+                std::rethrow_exception(std::exchange(error, nullptr));
+        }
+
+        void run(std::stop_token stop) {
+            std::unique_lock lock(mutex);
+            for (;;) {
+                if (!wake.wait(lock, stop, [this] { return written < requested; }))
+                    return;
+                size_t     offset = written;
+                size_t     end = requested;
+                std::byte* buffer = base;
+                lock.unlock();
+                try {
+                    write(buffer, offset, end - offset);
+
+                    // Discard the written memory. Reads now return zeros.
+                    adviseRange(buffer, end, offset, end - offset, access_pattern::dontneed);
+                } catch (const mapping_error&) {
+                    lock.lock();
+                    error = std::current_exception();
+                    written = requested;
+                    done.notify_all();
+                    continue;
+                }
+                lock.lock();
+                written = end;
+                done.notify_all();
+            }
+        }
+
+        FileDescriptor              file;
+        bool                        direct;
+        std::mutex                  mutex;
+        std::condition_variable_any wake;
+        std::condition_variable_any done;
+        std::byte*                  base = nullptr;
+        size_t                      requested = 0;
+        size_t                      written = 0;
+        std::exception_ptr          error;
+
+        // Declared last so it stops before everything it uses
+        std::jthread worker;
+    };
+
+    // Writes everything left, padding the final chunk to the page size O_DIRECT needs, then
+    // truncates the file to the exact size
+    void finish() {
+        if (!m_writer)
+            return;
+        try {
+            size_t size = m_memory.size();
+            m_writer->request(m_memory.data(), (size / m_chunkSize) * m_chunkSize);
+            m_writer->wait();
+            if (m_writer->worker.joinable()) {
+                m_writer->worker.request_stop();
+                m_writer->worker.join();
+            }
+            size_t tail = m_writer->written;
+            if (size > tail) {
+                size_t ps = pageSize();
+                m_writer->write(static_cast<const std::byte*>(m_memory.data()), tail,
+                                ((size - tail + ps - 1) / ps) * ps);
+            }
+            if (ftruncate(m_writer->file, off_t(size)) == -1 || fsync(m_writer->file) == -1)
+                throw LastError();
+        } catch (const std::exception& e) {
+            // can't throw from destructor. ignore the error
+            fprintf(stderr, "Error: %s\n", e.what());
+        }
+        m_writer.reset();
+    }
+
+    ResizableMappedMemory   m_memory;
+    size_t                  m_chunkSize;
+    std::unique_ptr<Writer> m_writer;
+};
+
+static_assert(std::is_move_constructible_v<StreamingFile>);
+static_assert(std::is_move_assignable_v<StreamingFile>);
+
+// Growable memory with a stable address that can be shared with other processes, backed by an
+// anonymous memfd. Forked children inherit the mapping at the same address. Other processes can
+// map it from nativeHandle(), e.g. passed over a unix socket or left open across exec(). Growing
+// in any process makes the pages available to all of them, but each must resize() to access
+// them. Shrinking frees the memory above the new size, so other processes must no longer access it.
+class ResizableSharedMemory {
+public:
+    using native_handle_type = int;
+    ResizableSharedMemory() = delete;
+    ResizableSharedMemory(const ResizableSharedMemory& other) = delete;
+    ResizableSharedMemory(ResizableSharedMemory&& other) noexcept = default;
+    ResizableSharedMemory(size_t initialSize, size_t maxSize, numa_placement placement = {})
+        : m_reserved(nullptr, maxSize, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)
+        , m_file(memfd_create("decodeless_shared_memory", MFD_CLOEXEC))
+        , m_placement(placement) {
+        if (initialSize)
+            resize(initialSize);
+    }
+
+    // Maps memory created by another instance from its nativeHandle(), which is duplicated so the
+    // caller keeps ownership. Pass the creator's data() as address to map it at the same address
+    // so pointers within it stay valid. This throws if that address range is not available.
+    ResizableSharedMemory(native_handle_type handle, size_t initialSize, size_t maxSize,
+                          void* address = nullptr, numa_placement placement = {})
+        : m_reserved(address, maxSize, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)
+        , m_file(fcntl(handle, F_DUPFD_CLOEXEC, 0))
+        , m_placement(placement) {
+        // Without MAP_FIXED the address is only a hint. MAP_FIXED_NOREPLACE would keep the
+        // reservation from being unmapped on destruction.
+        if (address && m_reserved.address() != address)
+            throw mapping_error("shared memory address range is not available");
+        if (initialSize)
+            resize(initialSize);
+    }
+    ResizableSharedMemory& operator=(const ResizableSharedMemory& other) = delete;
+    void*                  data() const { return m_size ? m_reserved.address() : nullptr; }
+    size_t                 size() const { return m_size; }
+    size_t                 capacity() const { return m_reserved.size(); }
+    native_handle_type     nativeHandle() const { return m_file; }
+    void                   resize(size_t size) {
+        if (size > m_reserved.size())
+            throw std::bad_alloc();
+        if (size > m_size) {
+            // Another process may have already grown the memfd
+            if (m_file.size() < size)
+                m_file.truncate(size);
+            if (m_mapped) {
+                m_mapped->extend(size, MAP_SHARED, m_file, 0);
+            } else {
+                m_mapped.emplace(m_reserved.address(), size, MAP_FIXED | MAP_SHARED, m_file, 0);
+                m_mapped->setUnmapSync(0); // nothing to write back
+            }
+
+            // The policy of shared memory applies to the memfd, so to all processes mapping it
+            size_t ps = pageSize();
+            size_t begin = (m_size / ps) * ps;
+            placeRange(static_cast<std::byte*>(m_reserved.address()) + begin,
+                       ((size + ps - 1) / ps) * ps - begin, m_placement);
+        } else if (size < m_size) {
+            if (size)
+                m_mapped->shrink(size);
+            else
+                m_mapped.reset();
+            m_file.truncate(size);
+        }
+        m_size = size;
+    }
+    void advise(size_t offset, size_t length, access_pattern pattern) const {
+        adviseRange(data(), m_size, offset, length, pattern);
+    }
+
+    // Override default move assignment so m_reserved outlives m_mapped
+    ResizableSharedMemory& operator=(ResizableSharedMemory&& other) noexcept {
+        m_mapped = std::move(other.m_mapped);
+        m_file = std::move(other.m_file);
+        m_reserved = std::move(other.m_reserved);
+        m_placement = other.m_placement;
+        m_size = other.m_size;
+        return *this;
+    }
+
+private:
+    detail::MemoryMap<PROT_NONE>       m_reserved;
+    FileDescriptor                     m_file;
+    std::optional<detail::MemoryMapRW> m_mapped;
+    numa_placement                     m_placement;
+    size_t                             m_size = 0;
+};
+
+static_assert(std::is_move_constructible_v<ResizableSharedMemory>);
+static_assert(std::is_move_assignable_v<ResizableSharedMemory>);
+
+// Circular buffer whose memory is mapped twice back to back, so data()[i] and
+// data()[i + capacity()] are the same byte. Reads and writes of up to capacity() bytes starting
+// anywhere in the first copy are contiguous across the wrap point, with no copying. The capacity
+// is rounded up to whole pages. Backed by an anonymous memfd or, for persistent queues, a file.
+// Read and write positions are left to the caller, e.g. stored in a separate header.
+class RingBuffer {
+public:
+    RingBuffer() = delete;
+    RingBuffer(const RingBuffer& other) = delete;
+    RingBuffer(RingBuffer&& other) noexcept = default;
+    RingBuffer(size_t minCapacity)
+        : RingBuffer(FileDescriptor(memfd_create("decodeless_ring_buffer", MFD_CLOEXEC)),
+                     minCapacity, 0) {}
+
+    // The file is grown to capacity() if needed and its existing contents are kept
+    RingBuffer(const fs::path& path, size_t minCapacity)
+        : RingBuffer(FileDescriptor(path, O_CREAT | O_RDWR, 0666), minCapacity,
+                     MS_SYNC | MS_INVALIDATE) {}
+    RingBuffer& operator=(const RingBuffer& other) = delete;
+
+    // Valid for 2 * capacity() bytes
+    void*  data() const { return m_lower.address(); }
+    size_t capacity() const { return m_lower.size(); }
+
+    // Address of a position that wraps around, with at least capacity() contiguous bytes after it
+    void* at(size_t position) const {
+        return static_cast<std::byte*>(data()) + position % capacity();
+    }
+
+    // Override default move assignment so m_reserved outlives the views
+    RingBuffer& operator=(RingBuffer&& other) noexcept {
+        m_upper = std::move(other.m_upper);
+        m_lower = std::move(other.m_lower);
+        m_file = std::move(other.m_file);
+        m_reserved = std::move(other.m_reserved);
+        return *this;
+    }
+
+private:
+    RingBuffer(FileDescriptor&& file, size_t minCapacity, int unmapSync)
+        : m_reserved(nullptr, 2 * roundUp(minCapacity), MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                     -1, 0)
+        , m_file(std::move(file))
+        , m_lower(m_reserved.address(), fileSize(m_file, m_reserved.size() / 2),
+                  MAP_FIXED | MAP_SHARED, m_file, 0)
+        , m_upper(static_cast<std::byte*>(m_reserved.address()) + m_lower.size(), m_lower.size(),
+                  MAP_FIXED | MAP_SHARED, m_file, 0) {
+        m_lower.setUnmapSync(unmapSync);
+        m_upper.setUnmapSync(0); // same pages as m_lower
+    }
+    static size_t roundUp(size_t size) {
+        size_t ps = pageSize();
+        size = std::max(size, ps);
+        if (size > std::numeric_limits<size_t>::max() / 2 - ps)
+            throw std::bad_alloc();
+        return ((size + ps - 1) / ps) * ps;
+    }
+
+    // Makes sure the file is large enough to map and returns size
+    static size_t fileSize(FileDescriptor& file, size_t size) {
+        if (file.size() < size)
+            file.truncate(size);
+        return size;
+    }
+    detail::MemoryMap<PROT_NONE> m_reserved;
+    FileDescriptor               m_file;
+    detail::MemoryMapRW          m_lower;
+    detail::MemoryMapRW          m_upper;
+};
+
+static_assert(std::is_move_constructible_v<RingBuffer>);
+static_assert(std::is_move_assignable_v<RingBuffer>);
+
 } // namespace detail
 
 } // namespace decodeless
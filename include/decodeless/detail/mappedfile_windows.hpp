@@ -3,10 +3,18 @@
 #pragma once
 
 #include <assert.h>
+#include <condition_variable>
+#include <cstring>
 #include <decodeless/detail/mappedfile_common.hpp>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
 #include <windows.h>
 
 // must come after windows.h
+#include <psapi.h>
 #include <subauth.h>
 
 namespace decodeless {
@@ -24,6 +32,16 @@ static inline size_t pageSizeCached() {
     return size;
 }
 
+// File views must start at a multiple of this, which is typically larger than the page size
+static inline size_t allocationGranularity() {
+    static size_t granularity = [] {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return size_t(info.dwAllocationGranularity);
+    }();
+    return granularity;
+}
+
 class Message {
 public:
     Message() = delete;
@@ -49,6 +67,13 @@ public:
         : mapping_error(Message(::GetLastError()).str()) {}
 };
 
+// Writes back dirty pages of a view. FlushViewOfFile() only starts the writeback, so the file
+// handle must also be flushed to wait for it, e.g. with FileHandle::flush().
+inline void flushView(const void* address, size_t length) {
+    if (length && !FlushViewOfFile(address, length))
+        throw LastError();
+}
+
 class LastMappedFileError : public mapped_file_error {
 public:
     LastMappedFileError(const fs::path& context)
@@ -56,6 +81,167 @@ public:
                             std::error_code(::GetLastError(), std::system_category())) {}
 };
 
+// Applies the part of an access_pattern hint Windows supports to the part of
+// [offset, offset + length) within a region of the given size. There is no equivalent for
+// sequential, random or hugepage so those are ignored. Discarding private memory (e.g. from
+// VirtualAlloc) drops its contents while for file views pages are just removed from the working
+// set.
+inline void adviseRange(const void* address, size_t size, size_t offset, size_t length,
+                        access_pattern pattern, bool privateMemory = false) {
+    size_t ps = pageSizeCached();
+    auto [begin, end] = pageRange(size, offset, length, ps);
+    if (end == begin)
+        return;
+    void* rangeAddress = reinterpret_cast<std::byte*>(const_cast<void*>(address)) + begin;
+    if (pattern == access_pattern::willneed) {
+        WIN32_MEMORY_RANGE_ENTRY range{.VirtualAddress = rangeAddress,
+                                       .NumberOfBytes = end - begin};
+        if (!PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0))
+            throw LastError();
+    } else if (pattern == access_pattern::dontneed) {
+        if (privateMemory) {
+            // Only whole pages can be discarded
+            size_t discardEnd = end - end % ps;
+            if (discardEnd > begin) {
+                DWORD result = DiscardVirtualMemory(rangeAddress, discardEnd - begin);
+                if (result != ERROR_SUCCESS)
+                    throw mapping_error(Message(result).str());
+            }
+        } else {
+            // VirtualUnlock() on an unlocked range removes its pages from the working set and
+            // fails with ERROR_NOT_LOCKED, which is expected.
+            if (!VirtualUnlock(rangeAddress, end - begin) && ::GetLastError() != ERROR_NOT_LOCKED)
+                throw LastError();
+        }
+    }
+}
+
+// Locks the pages of [offset, offset + length) within a region of the given size into the working
+// set with VirtualLock(), so they are never paged out. There is no lock-on-fault, so they are
+// faulted in immediately. If the lock would exceed the minimum working set size, both working set
+// limits are raised by the range and it is retried. They are not lowered again on unlock.
+inline void lockRange(const void* address, size_t size, size_t offset, size_t length) {
+    auto [begin, end] = pageRange(size, offset, length, pageSizeCached());
+    if (end == begin)
+        return;
+    void* start = reinterpret_cast<std::byte*>(const_cast<void*>(address)) + begin;
+    if (VirtualLock(start, end - begin))
+        return;
+    if (::GetLastError() != ERROR_WORKING_SET_QUOTA)
+        throw LastError();
+    SIZE_T minimum = 0;
+    SIZE_T maximum = 0;
+    if (!GetProcessWorkingSetSize(GetCurrentProcess(), &minimum, &maximum) ||
+        !SetProcessWorkingSetSize(GetCurrentProcess(), minimum + (end - begin),
+                                  maximum + (end - begin)) ||
+        !VirtualLock(start, end - begin))
+        throw LastError();
+}
+
+// Unlocking pages that are not locked fails with ERROR_NOT_LOCKED, which is ignored
+inline void unlockRange(const void* address, size_t size, size_t offset, size_t length) {
+    auto [begin, end] = pageRange(size, offset, length, pageSizeCached());
+    if (end != begin &&
+        !VirtualUnlock(reinterpret_cast<std::byte*>(const_cast<void*>(address)) + begin,
+                       end - begin) &&
+        ::GetLastError() != ERROR_NOT_LOCKED)
+        throw LastError();
+}
+
+// Commits [address, address + size) with the given NUMA placement using VirtualAllocExNuma().
+// Windows only has preferred nodes, so bind is treated as preferred. Interleaving alternates
+// nodes for each allocation granularity sized chunk, by address so growth continues the pattern.
+inline void commitRange(void* address, size_t size, const numa_placement& placement) {
+    auto* bytes = static_cast<std::byte*>(address);
+    if (placement.policy == numa_placement::mode::local || placement.nodes == 0) {
+        if (!VirtualAlloc(bytes, size, MEM_COMMIT, PAGE_READWRITE))
+            throw LastError();
+        return;
+    }
+    std::vector<DWORD> nodes;
+    for (DWORD node = 0; node < 64; ++node)
+        if (placement.nodes & (uint64_t(1) << node))
+            nodes.push_back(node);
+    if (placement.policy != numa_placement::mode::interleave) {
+        if (!VirtualAllocExNuma(GetCurrentProcess(), bytes, size, MEM_COMMIT, PAGE_READWRITE,
+                                nodes[0]))
+            throw LastError();
+        return;
+    }
+    size_t granularity = allocationGranularity();
+    for (std::byte* chunk = bytes; chunk < bytes + size;) {
+        uintptr_t  index = uintptr_t(chunk) / granularity;
+        std::byte* chunkEnd =
+            std::min(bytes + size, reinterpret_cast<std::byte*>((index + 1) * granularity));
+        if (!VirtualAllocExNuma(GetCurrentProcess(), chunk, chunkEnd - chunk, MEM_COMMIT,
+                                PAGE_READWRITE, nodes[index % nodes.size()]))
+            throw LastError();
+        chunk = chunkEnd;
+    }
+}
+
+// Returns the bytes of whole pages in [address, address + size) that are in the process working
+// set
+inline size_t residentBytes(const void* address, size_t size) {
+    constexpr size_t                              chunkPages = 4096;
+    size_t                                        ps = pageSizeCached();
+    size_t                                        pages = (size + ps - 1) / ps;
+    std::vector<PSAPI_WORKING_SET_EX_INFORMATION> info(std::min(pages, chunkPages));
+    size_t                                        result = 0;
+    auto*                                         bytes = static_cast<const std::byte*>(address);
+    for (size_t page = 0; page < pages; page += chunkPages) {
+        size_t count = std::min(chunkPages, pages - page);
+        for (size_t i = 0; i < count; ++i)
+            info[i].VirtualAddress = const_cast<std::byte*>(bytes + (page + i) * ps);
+        if (!QueryWorkingSetEx(GetCurrentProcess(), info.data(),
+                               DWORD(count * sizeof(PSAPI_WORKING_SET_EX_INFORMATION))))
+            throw LastError();
+        for (size_t i = 0; i < count; ++i)
+            result += info[i].VirtualAttributes.Valid ? ps : 0;
+    }
+    return result;
+}
+
+// Counts page faults taken by the process from construction, to attribute them to a user
+// specified scope. Windows doesn't distinguish hard faults per process, so all are reported as
+// minor faults.
+class FaultScope {
+public:
+    FaultScope()
+        : m_start(now()) {}
+    fault_counts faults() const {
+        fault_counts current = now();
+        return {current.major - m_start.major, current.minor - m_start.minor};
+    }
+
+private:
+    static fault_counts now() {
+        PROCESS_MEMORY_COUNTERS counters{};
+        if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+            throw LastError();
+        return {0, uint64_t(counters.PageFaultCount)};
+    }
+    fault_counts m_start;
+};
+
+// Populates pages for the part of [offset, offset + length) within a view of the given size. The
+// whole range is prefetched in one call so the I/O can be issued in parallel, then pages are
+// touched in chunks so that a stop request is noticed promptly.
+inline void prefaultRange(const void* address, size_t size, size_t offset, size_t length,
+                          std::stop_token stop = {}) {
+    constexpr size_t chunkSize = 16 * 1024 * 1024;
+    size_t           ps = pageSizeCached();
+    auto [begin, end] = pageRange(size, offset, length, ps);
+    if (end == begin)
+        return;
+    auto*                    bytes = reinterpret_cast<std::byte*>(const_cast<void*>(address));
+    WIN32_MEMORY_RANGE_ENTRY range{.VirtualAddress = bytes + begin, .NumberOfBytes = end - begin};
+    if (!PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0))
+        throw LastError();
+    for (size_t chunk = begin; chunk < end && !stop.stop_requested(); chunk += chunkSize)
+        touchPages(bytes + chunk, bytes + std::min(chunk + chunkSize, end), ps);
+}
+
 class Handle {
 public:
     Handle(HANDLE&& handle) noexcept
@@ -98,6 +284,34 @@ public:
         SetFilePointerEx(*this, LARGE_INTEGER{.QuadPart = distance}, nullptr, moveMethod);
     }
     void   setEndOfFile() { SetEndOfFile(*this); }
+
+    // Reserves disk space for the file without changing its size
+    void setAllocationSize(size_t size) {
+        FILE_ALLOCATION_INFO info{.AllocationSize = LARGE_INTEGER{.QuadPart = LONGLONG(size)}};
+        if (!SetFileInformationByHandle(*this, FileAllocationInfo, &info, sizeof(info)))
+            throw LastError();
+    }
+    void   flush() {
+        if (!FlushFileBuffers(*this))
+            throw LastError();
+    }
+
+    // Writes all of size bytes at offset without moving the file pointer
+    void write(size_t offset, const void* data, size_t size) {
+        auto* bytes = static_cast<const std::byte*>(data);
+        while (size) {
+            OVERLAPPED position{};
+            position.Offset = DWORD(offset);
+            position.OffsetHigh = DWORD(offset >> 32);
+            DWORD written = 0;
+            if (!WriteFile(*this, bytes, DWORD(std::min(size, size_t(1) << 30)), &written,
+                           &position))
+                throw LastError();
+            bytes += written;
+            offset += written;
+            size -= written;
+        }
+    }
     size_t size() {
         LARGE_INTEGER result;
         if (!GetFileSizeEx(*this, &result))
@@ -106,6 +320,83 @@ public:
     }
 };
 
+// True if path is an existing file with the same volume and file index as file. Opening it does
+// not need any access rights or block other handles.
+inline bool sameFile(const FileHandle& file, const fs::path& path) {
+    HANDLE other = CreateFileW(path.c_str(), 0,
+                               FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (other == INVALID_HANDLE_VALUE)
+        return false;
+    Handle                     otherHandle(std::move(other));
+    BY_HANDLE_FILE_INFORMATION a;
+    BY_HANDLE_FILE_INFORMATION b;
+    if (!GetFileInformationByHandle(file, &a) || !GetFileInformationByHandle(otherHandle, &b))
+        throw LastError();
+    return a.dwVolumeSerialNumber == b.dwVolumeSerialNumber &&
+           a.nFileIndexHigh == b.nFileIndexHigh && a.nFileIndexLow == b.nFileIndexLow;
+}
+
+// Writes [offset, offset + size) of source to a new file at path, replacing it if it exists.
+// Mapped views share the cache with ReadFile(), so unflushed writes are included. The new file is
+// deleted if copying fails. Throws mapping_error if path is the source itself, e.g. by name or a
+// hard link, as CREATE_ALWAYS would truncate it under its views.
+inline FileHandle cloneRange(const FileHandle& source, size_t offset, size_t size,
+                             const fs::path& path) {
+    if (sameFile(source, path))
+        throw mapping_error("snapshot target is the source file: " + path.string());
+    FileHandle result(path, GENERIC_WRITE | DELETE, 0, nullptr, CREATE_ALWAYS,
+                      FILE_ATTRIBUTE_NORMAL, nullptr);
+    try {
+        constexpr DWORD        chunkSize = 1024 * 1024;
+        std::vector<std::byte> buffer(std::min(size, size_t(chunkSize)));
+        for (size_t copied = 0; copied < size;) {
+            OVERLAPPED position{};
+            position.Offset = DWORD(offset + copied);
+            position.OffsetHigh = DWORD((offset + copied) >> 32);
+            DWORD read = 0;
+            if (!ReadFile(source, buffer.data(),
+                          DWORD(std::min(size - copied, size_t(chunkSize))), &read, &position) &&
+                GetLastError() != ERROR_HANDLE_EOF)
+                throw LastError();
+            if (read == 0)
+                break; // the source was truncated
+            DWORD written = 0;
+            if (!WriteFile(result, buffer.data(), read, &written, nullptr) || written != read)
+                throw LastError();
+            copied += read;
+        }
+    } catch (...) {
+        // Delete the partial file when the handle is closed
+        FILE_DISPOSITION_INFO dispose{.DeleteFile = TRUE};
+        SetFileInformationByHandle(result, FileDispositionInfo, &dispose, sizeof(dispose));
+        throw;
+    }
+    return result;
+}
+
+// Identifies a version of a file without opening it, e.g. to detect that a cached mapping of it
+// is stale because the file was modified or replaced
+class FileIdentity {
+public:
+    FileIdentity(const fs::path& path) {
+        WIN32_FILE_ATTRIBUTE_DATA result;
+        if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &result))
+            throw LastMappedFileError(path);
+        m_size = (uint64_t(result.nFileSizeHigh) << 32) | result.nFileSizeLow;
+        m_modified = (uint64_t(result.ftLastWriteTime.dwHighDateTime) << 32) |
+                     result.ftLastWriteTime.dwLowDateTime;
+        m_created = (uint64_t(result.ftCreationTime.dwHighDateTime) << 32) |
+                    result.ftCreationTime.dwLowDateTime;
+    }
+    bool operator==(const FileIdentity& other) const = default;
+
+private:
+    uint64_t m_size;
+    uint64_t m_modified;
+    uint64_t m_created;
+};
+
 class FileMappingHandle : public Handle {
 public:
     // Mapping backed by filesystem file
@@ -120,6 +411,14 @@ public:
         : FileMappingHandle(INVALID_HANDLE_VALUE, fileMappingAttributes, protect, maximumSize,
                             name) {}
 
+    // Takes ownership of an existing mapping handle, e.g. one duplicated from another process
+    explicit FileMappingHandle(HANDLE&& handle)
+        : Handle(std::move(handle)) {
+        if (!*this) {
+            throw LastError();
+        }
+    }
+
 private:
     FileMappingHandle(HANDLE fileHandle, LPSECURITY_ATTRIBUTES fileMappingAttributes, DWORD protect,
                       size_t maximumSize, LPCWSTR name = nullptr)
@@ -146,9 +445,14 @@ public:
     }
     FileMappingView() = delete;
     FileMappingView(const FileMappingView& other) = delete;
-    FileMappingView(FileMappingView&& other) noexcept { *this = std::move(other); }
+    FileMappingView(FileMappingView&& other) noexcept
+        : m_address(other.m_address) {
+        other.m_address = nullptr;
+    }
     FileMappingView& operator=(const FileMappingView& other) = delete;
     FileMappingView& operator=(FileMappingView&& other) noexcept {
+        if (m_address)
+            UnmapViewOfFile(m_address);
         m_address = other.m_address;
         other.m_address = nullptr;
         return *this;
@@ -165,25 +469,268 @@ private:
     LPVOID m_address;
 };
 
-template <bool Writable>
+// Policy options are resolved to CreateFileW(), CreateFileMappingW() and MapViewOfFile() flags
+// at compile time. Windows has no transparent huge pages, so page_size::transparent_huge is
+// accepted but has no effect.
+template <bool Writable, file_policy Policy = file_policy{}>
 class MappedFile {
+    static_assert(Policy.pages == page_size::normal || Policy.pages == page_size::transparent_huge,
+                  "large pages cannot back file mappings");
+    static constexpr bool  WritesFile = Writable && Policy.share == sharing::shared;
+    static constexpr DWORD FileAccess = GENERIC_READ | (WritesFile ? GENERIC_WRITE : 0);
+    static constexpr DWORD FileShare = FILE_SHARE_READ | (WritesFile ? FILE_SHARE_WRITE : 0);
+    static constexpr DWORD PageProtection =
+        WritesFile ? PAGE_READWRITE : (Writable ? PAGE_WRITECOPY : PAGE_READONLY);
+    static constexpr DWORD ViewAccess =
+        WritesFile ? FILE_MAP_WRITE : (Writable ? FILE_MAP_COPY : FILE_MAP_READ);
+
 public:
     using data_type = std::conditional_t<Writable, void*, const void*>;
     MappedFile(const fs::path& path)
-        : m_file(path, GENERIC_READ | (Writable ? GENERIC_WRITE : 0),
-                 FILE_SHARE_READ | (Writable ? FILE_SHARE_WRITE : 0), nullptr, OPEN_EXISTING,
-                 FILE_ATTRIBUTE_NORMAL, nullptr)
+        : m_file(path, FileAccess, FileShare, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                 nullptr)
         , m_size(m_file.size())
-        , m_mapping(m_file, nullptr, PAGE_READONLY, m_size, nullptr)
-        , m_rawView(m_mapping, FILE_MAP_READ) {}
-    data_type data() const { return m_rawView.address(); }
+        , m_mapping(m_file, nullptr, PageProtection, m_size, nullptr)
+        , m_rawView(m_mapping, ViewAccess) {
+        if constexpr (Policy.populate)
+            prefaultRange(data(), size(), 0, size());
+    }
+    MappedFile(const fs::path& path, durability mode)
+        requires Writable
+        : MappedFile(path) {
+        m_durability = mode;
+    }
+
+    // Maps only [offset, offset + length) of the file, clamped to its end. The view starts at the
+    // allocation granularity boundary before offset but data() points at the exact byte.
+    MappedFile(const fs::path& path, size_t offset, size_t length)
+        : m_file(path, FileAccess, FileShare, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                 nullptr)
+        , m_size(rangeSize(m_file.size(), offset, length))
+        , m_offset(offset)
+        , m_delta(offset % allocationGranularity())
+        , m_mapping(m_file, nullptr, PageProtection, 0, nullptr)
+        , m_rawView(m_mapping, ViewAccess, offset - m_delta, m_size + m_delta) {
+        if constexpr (Policy.populate)
+            prefaultRange(data(), size(), 0, size());
+    }
+    MappedFile(const fs::path& path, prefault populate)
+        : MappedFile(path) {
+        if (populate.background) {
+            m_prefaulter = std::jthread([address = data(), size = size(),
+                                         populate](std::stop_token stop) {
+                try {
+                    prefaultRange(address, size, populate.offset, populate.length, stop);
+                } catch (const mapping_error& e) {
+                    e.print(); // nowhere to throw to. it was only a hint anyway
+                }
+            });
+        } else {
+            prefaultRange(data(), size(), populate.offset, populate.length);
+        }
+    }
+    MappedFile(MappedFile&& other) noexcept = default;
+
+    // m_prefaulter is declared first so it is stopped before the view is replaced
+    MappedFile& operator=(MappedFile&& other) noexcept = default;
+    ~MappedFile() {
+        if (m_prefaulter.joinable()) {
+            m_prefaulter.request_stop();
+            m_prefaulter.join();
+        }
+        if constexpr (Writable) {
+            if (m_rawView.address() && m_durability != durability::none) {
+                flushView(m_rawView.address(), m_size + m_delta);
+                if (m_durability != durability::async)
+                    m_file.flush();
+            }
+        }
+    }
+    data_type data() const { return static_cast<std::byte*>(m_rawView.address()) + m_delta; }
     size_t    size() const { return m_size; }
 
+    // File offset of data()
+    size_t offset() const { return m_offset; }
+    void   advise(size_t offset, size_t length, access_pattern pattern) const {
+        adviseRange(m_rawView.address(), m_size + m_delta, offset + m_delta, length, pattern);
+    }
+
+    // Keeps [offset, offset + length) in memory, e.g. for latency critical tables. See
+    // lockRange(). Pages are unlocked when unmapped.
+    void lock(size_t offset, size_t length) const {
+        lockRange(m_rawView.address(), m_size + m_delta, offset + m_delta, length);
+    }
+    void unlock(size_t offset, size_t length) const {
+        unlockRange(m_rawView.address(), m_size + m_delta, offset + m_delta, length);
+    }
+    const FileHandle& nativeFile() const { return m_file; }
+    mapping_stats     stats() const {
+        return m_stats.snapshot(residentBytes(m_rawView.address(), m_size + m_delta), m_size,
+                                m_size + m_delta);
+    }
+
+    // Synchronously writes back dirty pages in the given range
+    void flush(size_t offset, size_t length)
+        requires Writable
+    {
+        if (offset < m_size) {
+            ScopedTimer timer(m_stats.syncs);
+            flushView(static_cast<std::byte*>(m_rawView.address()) + m_delta + offset,
+                      std::min(length, m_size - offset));
+            m_file.flush();
+        }
+    }
+    void flush()
+        requires Writable
+    {
+        flush(0, size());
+    }
+
+    // Opt-in dirty tracking. Records that [offset, offset + length) was modified, clamped to
+    // size(), so flush_dirty() writes back only what changed. Thread safe.
+    void mark_dirty(size_t offset, size_t length)
+        requires Writable
+    {
+        offset = std::min(offset, m_size);
+        m_dirty.mark(offset, std::min(length, m_size - offset));
+    }
+
+    // Ranges marked since the last flush_dirty()
+    std::vector<dirty_range> dirty_ranges() const
+        requires Writable
+    {
+        return m_dirty.ranges();
+    }
+
+    // Synchronously writes back just the marked ranges and returns them, e.g. to send the same
+    // bytes to a replica as a delta. The ranges are marked again if writing back fails.
+    std::vector<dirty_range> flush_dirty()
+        requires Writable
+    {
+        std::vector<dirty_range> ranges = m_dirty.take();
+        ScopedTimer              timer(m_stats.syncs);
+        try {
+            for (const dirty_range& range : ranges)
+                flushView(static_cast<std::byte*>(data()) + range.offset, range.length);
+            if (!ranges.empty())
+                m_file.flush();
+        } catch (...) {
+            for (const dirty_range& range : ranges)
+                m_dirty.mark(range.offset, range.length);
+            throw;
+        }
+        return ranges;
+    }
+
+    // Returns a read-only mapping of a point in time copy of this mapping's range, written to a
+    // new file at path. Later writes to either file are not visible in the other.
+    MappedFile<false> snapshot(const fs::path& path) const
+        requires Writable
+    {
+        cloneRange(m_file, m_offset, m_size, path);
+        return MappedFile<false>(path);
+    }
+
 private:
+    static size_t rangeSize(size_t fileSize, size_t offset, size_t length) {
+        return offset < fileSize ? std::min(length, fileSize - offset) : 0;
+    }
+    std::jthread      m_prefaulter;
     FileHandle        m_file;
     size_t            m_size;
+    size_t            m_offset = 0;
+    size_t            m_delta = 0; // from the aligned start of the view to data()
     FileMappingHandle m_mapping;
     FileMappingView   m_rawView;
+    durability        m_durability = WritesFile ? Policy.sync : durability::none;
+    OperationStats    m_stats;
+    DirtyRanges       m_dirty;
+};
+
+// Read-only mapping of a fixed size window of a file, which can be moved along the file with
+// seek(). Use this instead of MappedFile when the whole file doesn't fit in the address space.
+class MappedWindow {
+public:
+    MappedWindow(const fs::path& path, size_t windowSize, size_t offset = 0)
+        : m_file(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                 FILE_ATTRIBUTE_NORMAL, nullptr)
+        , m_fileSize(m_file.size())
+        , m_windowSize(windowSize)
+        , m_mapping(m_fileSize ? std::make_optional<FileMappingHandle>(m_file, nullptr,
+                                                                       PAGE_READONLY, m_fileSize,
+                                                                       nullptr)
+                               : std::nullopt) {
+        map(offset);
+    }
+
+    // nullptr for an empty file, which cannot be mapped
+    const void* data() const {
+        if (!m_view)
+            return nullptr;
+        return reinterpret_cast<const std::byte*>(m_view->address()) + (m_offset - m_mappedOffset);
+    }
+    size_t size() const {
+        return m_offset < m_fileSize ? std::min(m_windowSize, m_fileSize - m_offset) : 0;
+    }
+    size_t offset() const { return m_offset; }
+    size_t fileSize() const { return m_fileSize; }
+
+    // Moves the window to start at the given file offset. This is free while the window stays
+    // within the currently mapped range, otherwise the view is replaced.
+    void seek(size_t offset) {
+        if (offset < m_mappedOffset ||
+            std::min(offset + m_windowSize, m_fileSize) > m_mappedOffset + m_mappedSize)
+            map(offset);
+        m_offset = offset;
+    }
+
+    // Advises the part of [offset, offset + length) of the window that is within the file,
+    // relative to the granularity aligned view like the other mappings
+    void advise(size_t offset, size_t length, access_pattern pattern) const {
+        if (!m_view)
+            return;
+        offset = std::min(offset, size());
+        adviseRange(m_view->address(), m_mappedSize, offset + (m_offset - m_mappedOffset),
+                    std::min(length, size() - offset), pattern);
+    }
+    mapping_stats stats() const {
+        return m_stats.snapshot(m_view ? residentBytes(m_view->address(), m_mappedSize) : 0,
+                                m_mappedSize,
+                                m_mappedSize);
+    }
+
+private:
+    void map(size_t offset) {
+        // Views of an empty file are empty too. Nothing is mapped, so there is nothing to clamp.
+        if (m_fileSize == 0) {
+            m_offset = offset;
+            return;
+        }
+        ScopedTimer timer(m_stats.remaps);
+
+        // Leave room for the window to start anywhere in the first granule, but views cannot
+        // extend past the end of the file. Past the end, keep the last granule mapped.
+        size_t granularity = allocationGranularity();
+        size_t mappedOffset = std::min(offset, m_fileSize - 1);
+        mappedOffset -= mappedOffset % granularity;
+        size_t mappedSize =
+            std::min(((m_windowSize + granularity - 1) / granularity + 1) * granularity,
+                     m_fileSize - mappedOffset);
+        m_view.reset();
+        m_view.emplace(*m_mapping, FILE_MAP_READ, mappedOffset, mappedSize);
+        m_offset = offset;
+        m_mappedOffset = mappedOffset;
+        m_mappedSize = mappedSize;
+    }
+    FileHandle                       m_file;
+    size_t                           m_fileSize;
+    size_t                           m_windowSize;
+    size_t                           m_offset = 0;
+    size_t                           m_mappedOffset = 0;
+    size_t                           m_mappedSize = 0;
+    std::optional<FileMappingHandle> m_mapping;
+    std::optional<FileMappingView>   m_view;
+    OperationStats                   m_stats;
 };
 
 class DynamicLibrary {
@@ -347,10 +894,12 @@ public:
     NtUnmapViewOfSectionType* const    m_NtUnmapViewOfSection;
 };
 
-// It is cumbersome to pass around a module handle, so this static call returns a common one when
-// needed. Ideally this would be in just one compilation unit but this is a header-only library.
-static inline NtifsSection& ntifs() {
-    static NtifsSection ntifs;
+// It is cumbersome to pass around a module handle, so this returns a common one when needed. The
+// table is resolved on first use, thread safely, and is shared by every type and translation unit
+// for the life of the process. An inline function has one static per program, whereas a static
+// one would have a copy per translation unit.
+inline const NtifsSection& ntifs() {
+    static const NtifsSection ntifs;
     return ntifs;
 }
 
@@ -583,24 +1132,115 @@ private:
 static_assert(std::is_move_constructible_v<SectionView<PAGE_READWRITE>>);
 static_assert(std::is_move_assignable_v<SectionView<PAGE_READWRITE>>);
 
+// A section and a view of it in the current process, created together. The view is declared last
+// so it is unmapped before the section handle is closed.
+template <ULONG SectionPageProtection>
+struct MappedSection {
+    MappedSection(const NtifsSection& dll, ACCESS_MASK DesiredAccess, size_t MaximumSize,
+                  ULONG AllocationAttributes, HANDLE FileHandle, size_t ViewSize,
+                  ULONG ViewAllocationType)
+        : section(dll, DesiredAccess, nullptr, MaximumSize, AllocationAttributes, FileHandle)
+        , view(dll, section, NtifsSection::CurrentProcess(), 0, 0, 0, ViewSize, ViewUnmap,
+               ViewAllocationType) {}
+    Section<SectionPageProtection>     section;
+    SectionView<SectionPageProtection> view;
+};
+
+// Address space budget shared by many resizable objects. Windows has no mapping count limit like
+// Linux's vm.max_map_count and an extendable section view cannot be placed inside another
+// reservation, so each object still reserves its own range and the arena only bounds their total.
+// Must outlive everything allocated from it.
+class AddressSpaceArena {
+public:
+    AddressSpaceArena(size_t size)
+        : m_size(roundUp(size))
+        , m_ranges(m_size) {}
+    AddressSpaceArena(const AddressSpaceArena& other) = delete;
+    AddressSpaceArena& operator=(const AddressSpaceArena& other) = delete;
+
+    // Returns an offset identifying size bytes of the budget, or throws std::bad_alloc if the
+    // arena is full
+    size_t allocate(size_t size) { return m_ranges.allocate(roundUp(size), 1); }
+    void   deallocate(size_t offset, size_t size) { m_ranges.deallocate(offset, roundUp(size)); }
+    size_t size() const { return m_size; }
+    size_t available() const { return m_ranges.available(); }
+
+private:
+    static size_t roundUp(size_t size) {
+        size_t granularity = allocationGranularity();
+        return (std::max(size, size_t(1)) + granularity - 1) / granularity * granularity;
+    }
+    size_t         m_size;
+    RangeAllocator m_ranges;
+};
+
+// Part of an AddressSpaceArena's budget, returned when destroyed
+class ArenaCharge {
+public:
+    ArenaCharge() = default;
+    ArenaCharge(AddressSpaceArena& arena, size_t size)
+        : m_arena(&arena)
+        , m_offset(arena.allocate(size))
+        , m_size(size) {}
+    ArenaCharge(const ArenaCharge& other) = delete;
+    ArenaCharge(ArenaCharge&& other) noexcept
+        : m_arena(std::exchange(other.m_arena, nullptr))
+        , m_offset(other.m_offset)
+        , m_size(other.m_size) {}
+    ArenaCharge& operator=(const ArenaCharge& other) = delete;
+    ArenaCharge& operator=(ArenaCharge&& other) noexcept {
+        release();
+        m_arena = std::exchange(other.m_arena, nullptr);
+        m_offset = other.m_offset;
+        m_size = other.m_size;
+        return *this;
+    }
+    ~ArenaCharge() { release(); }
+
+private:
+    void release() {
+        if (m_arena)
+            m_arena->deallocate(m_offset, m_size);
+    }
+    AddressSpaceArena* m_arena = nullptr;
+    size_t             m_offset = 0;
+    size_t             m_size = 0;
+};
+
 class ResizableMappedFile {
 public:
-    ResizableMappedFile(const fs::path& path, size_t maxSize)
+    ResizableMappedFile(const fs::path& path, size_t maxSize,
+                        growth_policy growth = growth_policy::exact(),
+                        durability    mode = durability::sync_on_close)
         : m_capacity(maxSize)
         , m_file(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
-                 OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr) {
+                 OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr)
+        , m_growth(growth)
+        , m_durability(mode) {
         size_t existingSize = m_file.size();
         if (existingSize > 0)
             resize(existingSize);
     }
+
+    // Counts maxSize bytes against arena. See AddressSpaceArena.
+    ResizableMappedFile(AddressSpaceArena& arena, const fs::path& path, size_t maxSize,
+                        growth_policy growth = growth_policy::exact(),
+                        durability    mode = durability::sync_on_close)
+        : ResizableMappedFile(path, maxSize, growth, mode) {
+        m_arenaCharge = ArenaCharge(arena, maxSize);
+    }
     ~ResizableMappedFile() {
         // Truncate the file to the last size requested.
         if (m_file) {
             size_t finalSize = size();
+            if (m_mapping && m_durability != durability::none) {
+                flushView(m_mapping->view.address(), finalSize);
+                if (m_durability != durability::async)
+                    m_file.flush();
+            }
 
             // Unmap the file before truncating the file
-            m_view.reset();
-            m_section.reset();
+            m_mapping.reset();
 
             // Truncate
             m_file.setPointer(finalSize);
@@ -609,31 +1249,189 @@ public:
     }
     ResizableMappedFile(ResizableMappedFile&& other) = default;
     ResizableMappedFile& operator=(ResizableMappedFile&& other) = default;
-    void*  data() const { return m_view ? m_view->address() : nullptr; }
-    size_t size() const { return m_section ? m_section->size() : 0; }
+    void*  data() const { return m_mapping ? m_mapping->view.address() : nullptr; }
+    size_t size() const { return m_size; }
     size_t capacity() const { return m_capacity; }
     void   resize(size_t size) {
         // Artificially fail on overflow. This seems to "just work" for windows,
         // but is probably unpredictable if there is no address space to expand.
+        ScopedTimer timer(m_stats.resizes);
         if (size > m_capacity)
             throw std::bad_alloc();
 
+        if (m_mapping &&
+            (m_durability == durability::sync || m_durability == durability::async)) {
+            ScopedTimer syncTimer(m_stats.syncs);
+            flushView(m_mapping->view.address(), m_size);
+            if (m_durability == durability::sync)
+                m_file.flush();
+        }
+
         // Note: truncation is ignored until the object is destroyed
-        if (m_section) {
-            m_section->extend(size);
-        } else {
-            m_section.emplace(ntifs(), SECTION_MAP_WRITE | SECTION_MAP_READ | SECTION_EXTEND_SIZE,
-                                nullptr, size, SEC_COMMIT, m_file);
-            m_view.emplace(ntifs(), *m_section, NtifsSection::CurrentProcess(), 0, 0, 0, m_capacity,
-                             ViewUnmap, MEM_RESERVE);
+        if (size > m_sectionSize)
+            grow(size);
+        m_size = size;
+        if (m_committed > size)
+            std::atomic_ref(m_committed).store(size, std::memory_order_relaxed);
+    }
+
+    // Thread safe, lock free append. Atomically reserves bytes at the end of size() and returns a
+    // pointer to them that stays valid for the object's lifetime. The section is extended by one
+    // thread while others crossing the same boundary wait, so use a growth_policy that grows in
+    // chunks. Must not be called concurrently with other non-const methods, e.g. resize().
+    // If growing fails, e.g. with a full disk, the exception is rethrown and size() is
+    // restored. If other threads appended meanwhile it can't be, and size() stays past the end of
+    // the backed range, so only access what earlier calls returned and resize() back to a known
+    // size before continuing.
+    void* reserve_append(size_t bytes) {
+        size_t offset = bumpShared(m_size, bytes, m_capacity);
+        if (offset + bytes == 0)
+            return nullptr; // there may be no view yet
+        try {
+            growShared(m_sectionSize, m_growing, offset + bytes, [this](size_t end) { grow(end); });
+        } catch (...) {
+            unbumpShared(m_size, offset, bytes);
+            throw;
+        }
+        return static_cast<std::byte*>(m_mapping->view.address()) + offset;
+    }
+
+    // Publishes that the first length bytes, clamped to size(), are fully written, e.g. after
+    // appending a record. Concurrent readers that see the length from committed() can read that
+    // many bytes from data() without locks. Thread safe, including with reserve_append(), but it
+    // never lowers the committed length, so callers must only commit a fully written prefix.
+    void commit(size_t length) {
+        publishShared(m_committed,
+                      std::min(length, std::atomic_ref(m_size).load(std::memory_order_relaxed)));
+    }
+
+    // Length last published by commit(), loaded with acquire ordering so that many bytes from
+    // data() are safe to read from any thread. data() does not change once anything is
+    // committed. Shrinking with resize() lowers it, which is not safe with concurrent readers.
+    size_t committed() const { return loadPublished(m_committed); }
+
+    // Copies length bytes from source to offset, growing size() first if needed. Whole pages are
+    // written with WriteFile() instead of through the view. The cache is shared, so they appear in
+    // the view, but pages not faulted in yet are filled directly rather than zeroed or read on the
+    // first touch only to be overwritten.
+    void write(size_t offset, const void* source, size_t length) {
+        if (length == 0)
+            return;
+        if (offset > m_capacity || length > m_capacity - offset)
+            throw std::bad_alloc();
+        if (offset + length > m_size)
+            resize(offset + length);
+        auto*  bytes = static_cast<const std::byte*>(source);
+        auto*  target = static_cast<std::byte*>(data());
+        size_t ps = pageSizeCached();
+        size_t end = offset + length;
+        size_t pagesBegin = std::min((offset + ps - 1) / ps * ps, end);
+        size_t pagesEnd = std::max(end / ps * ps, pagesBegin);
+        memcpy(target + offset, bytes, pagesBegin - offset);
+        m_file.write(pagesBegin, bytes + (pagesBegin - offset), pagesEnd - pagesBegin);
+        memcpy(target + pagesEnd, bytes + (pagesEnd - offset), end - pagesEnd);
+    }
+
+    // Synchronously writes back dirty pages in the given range
+    void flush(size_t offset, size_t length) {
+        if (m_mapping && offset < m_size) {
+            ScopedTimer timer(m_stats.syncs);
+            flushView(static_cast<std::byte*>(m_mapping->view.address()) + offset,
+                      std::min(length, m_size - offset));
+            m_file.flush();
+        }
+    }
+    void flush() { flush(0, m_size); }
+
+    // Opt-in dirty tracking. Records that [offset, offset + length) was modified, clamped to
+    // size(), so flush_dirty() writes back only what changed. Thread safe, including with
+    // reserve_append().
+    void mark_dirty(size_t offset, size_t length) {
+        size_t size = std::atomic_ref(m_size).load(std::memory_order_relaxed);
+        offset = std::min(offset, size);
+        m_dirty.mark(offset, std::min(length, size - offset));
+    }
+
+    // Ranges marked since the last flush_dirty()
+    std::vector<dirty_range> dirty_ranges() const { return m_dirty.ranges(); }
+
+    // Synchronously writes back just the marked ranges and returns them, e.g. to send the same
+    // bytes to a replica as a delta. The ranges are marked again if writing back fails.
+    std::vector<dirty_range> flush_dirty() {
+        std::vector<dirty_range> ranges = m_dirty.take();
+        if (!m_mapping)
+            return ranges;
+        ScopedTimer timer(m_stats.syncs);
+        try {
+            for (const dirty_range& range : ranges)
+                if (range.offset < m_size)
+                    flushView(static_cast<std::byte*>(m_mapping->view.address()) + range.offset,
+                              std::min(range.length, m_size - range.offset));
+            if (!ranges.empty())
+                m_file.flush();
+        } catch (...) {
+            for (const dirty_range& range : ranges)
+                m_dirty.mark(range.offset, range.length);
+            throw;
         }
+        return ranges;
+    }
+
+    // Returns a read-only mapping of a point in time copy of size() bytes, written to a new file
+    // at path while this file stays writable. Not thread safe with concurrent writes to the
+    // mapping or reserve_append() calls.
+    MappedFile<false> snapshot(const fs::path& path) const {
+        cloneRange(m_file, 0, m_size, path);
+        return MappedFile<false>(path);
+    }
+
+    void advise(size_t offset, size_t length, access_pattern pattern) const {
+        adviseRange(data(), m_size, offset, length, pattern);
+    }
+
+    // Keeps [offset, offset + length) of size() in memory. See lockRange().
+    void lock(size_t offset, size_t length) const { lockRange(data(), m_size, offset, length); }
+    void unlock(size_t offset, size_t length) const { unlockRange(data(), m_size, offset, length); }
+    const FileHandle& nativeFile() const { return m_file; }
+
+    // Not thread safe with concurrent reserve_append() calls
+    mapping_stats stats() const {
+        return m_stats.snapshot(m_mapping ? residentBytes(data(), m_sectionSize) : 0,
+                                m_sectionSize, m_capacity);
     }
 
 private:
-    size_t                                     m_capacity = 0;
-    FileHandle                                 m_file;
-    std::optional<Section<PAGE_READWRITE>>     m_section;
-    std::optional<SectionView<PAGE_READWRITE>> m_view;
+    void grow(size_t size) {
+        ScopedTimer timer(m_stats.remaps);
+        size_t      sectionSize = m_growth(m_sectionSize, size, m_capacity);
+
+        // Blocks are allocated but not zero filled. SetFileValidData() would avoid the zeroing on
+        // first write but needs SE_MANAGE_VOLUME_NAME and exposes stale data.
+        if (m_growth.preallocate)
+            m_file.setAllocationSize(sectionSize);
+        if (m_mapping) {
+            m_mapping->section.extend(sectionSize);
+        } else {
+            m_mapping.emplace(ntifs(), SECTION_MAP_WRITE | SECTION_MAP_READ | SECTION_EXTEND_SIZE,
+                              sectionSize, SEC_COMMIT, m_file, m_capacity, MEM_RESERVE);
+        }
+
+        // Publishes the new pages to reserve_append() callers
+        std::atomic_ref(m_sectionSize).store(sectionSize, std::memory_order_release);
+    }
+
+    size_t                                       m_capacity = 0;
+    size_t                                       m_size = 0;
+    size_t                                       m_sectionSize = 0;
+    size_t                                       m_committed = 0;
+    bool                                         m_growing = false;
+    FileHandle                                   m_file;
+    growth_policy                                m_growth;
+    durability                                   m_durability;
+    std::optional<MappedSection<PAGE_READWRITE>> m_mapping;
+    OperationStats                               m_stats;
+    ArenaCharge                                  m_arenaCharge;
+    DirtyRanges                                  m_dirty;
 };
 
 static_assert(std::is_move_constructible_v<ResizableMappedFile>);
@@ -641,42 +1439,431 @@ static_assert(std::is_move_assignable_v<ResizableMappedFile>);
 
 class ResizableMappedMemory {
 public:
-    ResizableMappedMemory(size_t initialSize, size_t maxSize)
+    // Large pages can only be allocated by reserving and committing in one call, so when
+    // requested the whole capacity is committed up front and resize() is just bookkeeping.
+    // Transparent huge pages have no equivalent and are ignored.
+    //
+    // Shrinking decommits memory above the new size, except for up to releaseThreshold bytes that
+    // are kept committed so oscillating sizes don't repeatedly commit and decommit the same pages
+    //
+    // NUMA placement applies to pages as they are committed, so not to large pages
+    ResizableMappedMemory(size_t initialSize, size_t maxSize, page_size pages = page_size::normal,
+                          size_t releaseThreshold = 0, numa_placement placement = {})
         : m_capacity(maxSize)
-        , m_memory(ntifs(), NtifsSection::CurrentProcess(), 0, m_capacity, MEM_RESERVE,
-                   PAGE_NOACCESS) {
+        , m_releaseThreshold(releaseThreshold)
+        , m_placement(placement)
+        , m_largePages(pages == page_size::huge_2mb || pages == page_size::huge_1gb)
+        , m_memory(ntifs(), NtifsSection::CurrentProcess(), 0,
+                   m_largePages ? largePageRoundUp(m_capacity) : m_capacity,
+                   m_largePages ? MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES : MEM_RESERVE,
+                   m_largePages ? PAGE_READWRITE : PAGE_NOACCESS) {
         if (initialSize)
             resize(initialSize);
     }
+
+    // Counts maxSize bytes against arena. See AddressSpaceArena.
+    ResizableMappedMemory(AddressSpaceArena& arena, size_t initialSize, size_t maxSize,
+                          page_size pages = page_size::normal, size_t releaseThreshold = 0,
+                          numa_placement placement = {})
+        : ResizableMappedMemory(initialSize, maxSize, pages, releaseThreshold, placement) {
+        m_arenaCharge = ArenaCharge(arena, maxSize);
+    }
     void*  data() const { return m_size ? m_memory.address() : nullptr; }
     size_t size() const { return m_size; }
     size_t capacity() const { return m_capacity; }
     void   resize(size_t size) {
         // Artificially fail on overflow. The NtAllocateVirtualMemory() call succeeds without error,
         // but the memory becomes unreadable afterwards.
+        ScopedTimer timer(m_stats.resizes);
         if (size > m_capacity)
             throw std::bad_alloc();
 
-        if (size > m_size)
-            m_memory.commit(0, 0, size, PAGE_READWRITE);
-        else
-            m_memory.decommit(size, m_size - size);
+        // Large pages are already committed
+        if (!m_largePages) {
+            if (size > m_committedSize) {
+                ScopedTimer commitTimer(m_stats.remaps);
+                if (m_placement.policy == numa_placement::mode::local)
+                    m_memory.commit(0, 0, size, PAGE_READWRITE);
+                else
+                    commitRange(static_cast<std::byte*>(m_memory.address()) + m_committedSize,
+                                size - m_committedSize, m_placement);
+                if (m_lockGrowth)
+                    lockRange(m_memory.address(), size, m_committedSize, size - m_committedSize);
+                m_committedSize = size;
+            } else {
+                size_t keep = size + std::min(m_releaseThreshold, m_capacity - size);
+                if (keep < m_committedSize) {
+                    ScopedTimer decommitTimer(m_stats.remaps);
+                    m_memory.decommit(keep, m_committedSize - keep);
+                    m_committedSize = keep;
+                }
+            }
+        }
         m_size = size;
     }
+    void advise(size_t offset, size_t length, access_pattern pattern) const {
+        adviseRange(m_memory.address(), m_size, offset, length, pattern, true);
+    }
+
+    // Keeps [offset, offset + length) in memory. See lockRange(). If the range reaches size(),
+    // e.g. lock(0, capacity()), pages committed by later resize() calls are locked too, until a
+    // range reaching size() is unlocked. Decommitted pages are unlocked.
+    void lock(size_t offset, size_t length) {
+        bool toEnd = length >= m_size - std::min(offset, m_size);
+        lockRange(m_memory.address(), toEnd ? committedSize() : m_size, offset, length);
+        m_lockGrowth = m_lockGrowth || toEnd;
+    }
+    void unlock(size_t offset, size_t length) {
+        bool toEnd = length >= m_size - std::min(offset, m_size);
+        unlockRange(m_memory.address(), toEnd ? committedSize() : m_size, offset, length);
+        m_lockGrowth = m_lockGrowth && !toEnd;
+    }
+    mapping_stats stats() const {
+        size_t committed = committedSize();
+        return m_stats.snapshot(residentBytes(m_memory.address(), committed), committed,
+                                m_capacity);
+    }
 
 private:
-    static NtifsSection& ntifs() {
-        static NtifsSection ntifs;
-        return ntifs;
+    size_t committedSize() const {
+        return m_largePages ? largePageRoundUp(m_capacity) : m_committedSize;
+    }
+    static size_t largePageRoundUp(size_t size) {
+        size_t granularity = GetLargePageMinimum();
+        return granularity ? ((size + granularity - 1) / granularity) * granularity : size;
     }
-    size_t        m_capacity = 0;
-    size_t        m_size = 0;
-    VirtualMemory m_memory;
+    size_t         m_capacity = 0;
+    size_t         m_releaseThreshold = 0;
+    numa_placement m_placement;
+    size_t         m_size = 0;
+    size_t         m_committedSize = 0;
+    bool           m_largePages = false;
+    bool           m_lockGrowth = false;
+    VirtualMemory  m_memory;
+    OperationStats m_stats;
+    ArenaCharge    m_arenaCharge;
 };
 
 static_assert(std::is_move_constructible_v<ResizableMappedMemory>);
 static_assert(std::is_move_assignable_v<ResizableMappedMemory>);
 
+// Growable buffer for writing large files once without polluting the file cache. Writes go to a
+// ResizableMappedMemory. Each resize() hands the chunks wholly below the previous size() to a
+// background thread that writes them to the file with FILE_FLAG_NO_BUFFERING and then discards
+// their memory, so data must be written before calling resize() again. Written chunks have
+// undefined contents and size() cannot be reduced below them. The rest is written and the file
+// truncated to size() when the object is destroyed.
+class StreamingFile {
+public:
+    StreamingFile(const fs::path& path, size_t maxSize, size_t chunkSize = 8 * 1024 * 1024)
+        : m_memory(0, maxSize)
+        , m_chunkSize(std::max(pageSizeCached(), chunkSize - chunkSize % pageSizeCached()))
+        , m_writer(std::make_unique<Writer>(path)) {}
+    StreamingFile(StreamingFile&& other) noexcept = default;
+    ~StreamingFile() { finish(); }
+    StreamingFile& operator=(StreamingFile&& other) noexcept {
+        finish();
+        m_writer = std::move(other.m_writer);
+        m_memory = std::move(other.m_memory);
+        m_chunkSize = other.m_chunkSize;
+        return *this;
+    }
+    void*  data() const { return m_memory.data(); }
+    size_t size() const { return m_memory.size(); }
+    size_t capacity() const { return m_memory.capacity(); }
+
+    // Throws any error from writing previous chunks
+    void resize(size_t size) {
+        std::unique_lock lock(m_writer->mutex);
+        m_writer->rethrow();
+        if (size < m_writer->requested)
+            throw mapping_error("cannot shrink a streaming_file below data already written");
+        size_t complete = (m_memory.size() / m_chunkSize) * m_chunkSize;
+        lock.unlock();
+        m_memory.resize(size);
+        m_writer->request(m_memory.data(), std::min(complete, (size / m_chunkSize) * m_chunkSize));
+    }
+
+    // Waits for all complete chunks to be written
+    void flush() { m_writer->wait(); }
+
+private:
+    struct Writer {
+        Writer(const fs::path& path)
+            : file(path, GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+                   FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING, nullptr) {}
+
+        // Writes [offset, offset + length) of the buffer at the same file offset
+        void write(const std::byte* buffer, size_t offset, size_t length) {
+            constexpr size_t maxWrite = 1024 * 1024 * 1024;
+            size_t           end = offset + length;
+            while (offset < end) {
+                OVERLAPPED overlapped{};
+                overlapped.Offset = DWORD(offset & 0xffffffff);
+                overlapped.OffsetHigh = DWORD(offset >> 32);
+                DWORD written = 0;
+                if (!WriteFile(file, buffer + offset, DWORD(std::min(end - offset, maxWrite)),
+                               &written, &overlapped))
+                    throw LastError();
+                offset += written;
+            }
+        }
+
+        // Queues chunks up to end to be written in the background
+        void request(void* buffer, size_t end) {
+            {
+                std::lock_guard lock(mutex);
+                if (end <= requested)
+                    return;
+                base = static_cast<std::byte*>(buffer);
+                requested = end;
+            }
+            if (!worker.joinable())
+                worker = std::jthread([this](std::stop_token stop) { run(stop); });
+            wake.notify_one();
+        }
+
+        void wait() {
+            std::unique_lock lock(mutex);
+            done.wait(lock, [this] { return written == requested; });
+            rethrow();
+        }
+
+        void rethrow() {
+            if (error)
+                std::rethrow_exception(std::exchange(error, nullptr));
+        }
+
+        void run(std::stop_token stop) {
+            std::unique_lock lock(mutex);
+            for (;;) {
+                if (!wake.wait(lock, stop, [this] { return written < requested; }))
+                    return;
+                size_t     offset = written;
+                size_t     end = requested;
+                std::byte* buffer = base;
+                lock.unlock();
+                try {
+                    write(buffer, offset, end - offset);
+
+                    // Discard the written memory
+                    adviseRange(buffer, end, offset, end - offset, access_pattern::dontneed, true);
+                } catch (const mapping_error&) {
+                    lock.lock();
+                    error = std::current_exception();
+                    written = requested;
+                    done.notify_all();
+                    continue;
+                }
+                lock.lock();
+                written = end;
+                done.notify_all();
+            }
+        }
+
+        FileHandle                  file;
+        std::mutex                  mutex;
+        std::condition_variable_any wake;
+        std::condition_variable_any done;
+        std::byte*                  base = nullptr;
+        size_t                      requested = 0;
+        size_t                      written = 0;
+        std::exception_ptr          error;
+
+        // Declared last so it stops before everything it uses
+        std::jthread worker;
+    };
+
+    // Writes everything left, padding the final chunk to the page size unbuffered writes need,
+    // then truncates the file to the exact size
+    void finish() {
+        if (!m_writer)
+            return;
+        try {
+            size_t size = m_memory.size();
+            m_writer->request(m_memory.data(), (size / m_chunkSize) * m_chunkSize);
+            m_writer->wait();
+            if (m_writer->worker.joinable()) {
+                m_writer->worker.request_stop();
+                m_writer->worker.join();
+            }
+            size_t tail = m_writer->written;
+            if (size > tail) {
+                size_t ps = pageSizeCached();
+                m_writer->write(static_cast<const std::byte*>(m_memory.data()), tail,
+                                ((size - tail + ps - 1) / ps) * ps);
+            }
+            m_writer->file.setPointer(ptrdiff_t(size));
+            m_writer->file.setEndOfFile();
+            m_writer->file.flush();
+        } catch (const std::exception& e) {
+            // can't throw from destructor. ignore the error
+            fprintf(stderr, "Error: %s\n", e.what());
+        }
+        m_writer.reset();
+    }
+
+    ResizableMappedMemory   m_memory;
+    size_t                  m_chunkSize;
+    std::unique_ptr<Writer> m_writer;
+};
+
+static_assert(std::is_move_constructible_v<StreamingFile>);
+static_assert(std::is_move_assignable_v<StreamingFile>);
+
+// Growable memory with a stable address that can be shared with other processes, backed by a
+// pagefile section reserved up front and committed as it grows. Other processes can map it from
+// a duplicate of nativeHandle(). Growing in any process makes the pages available to all of
+// them, but each must resize() to access them. Committed section pages cannot be decommitted, so
+// shrinking is just bookkeeping and memory is freed when the last view is closed.
+//
+// NtExtendSection() only supports file backed sections, so unlike ResizableMappedFile this
+// reserves the whole capacity with SEC_RESERVE and commits pages with VirtualAlloc().
+class ResizableSharedMemory {
+public:
+    using native_handle_type = HANDLE;
+    ResizableSharedMemory(size_t initialSize, size_t maxSize, numa_placement placement = {})
+        : m_capacity(maxSize)
+        , m_placement(placement)
+        , m_mapping(nullptr, PAGE_READWRITE | SEC_RESERVE, maxSize)
+        , m_view(m_mapping, FILE_MAP_WRITE) {
+        if (initialSize)
+            resize(initialSize);
+    }
+
+    // Maps memory created by another instance from its nativeHandle(), which is duplicated so the
+    // caller keeps ownership. Pass the creator's data() as address to map it at the same address
+    // so pointers within it stay valid. This throws if that address range is not available.
+    ResizableSharedMemory(native_handle_type handle, size_t initialSize, size_t maxSize,
+                          void* address = nullptr, numa_placement placement = {})
+        : m_capacity(maxSize)
+        , m_placement(placement)
+        , m_mapping(duplicate(handle))
+        , m_view(m_mapping, FILE_MAP_WRITE, 0, maxSize, address) {
+        if (initialSize)
+            resize(initialSize);
+    }
+    ResizableSharedMemory(ResizableSharedMemory&& other) noexcept = default;
+    ResizableSharedMemory& operator=(ResizableSharedMemory&& other) noexcept = default;
+    void*                  data() const { return m_size ? m_view.address() : nullptr; }
+    size_t                 size() const { return m_size; }
+    size_t                 capacity() const { return m_capacity; }
+    native_handle_type     nativeHandle() const { return m_mapping; }
+    void                   resize(size_t size) {
+        if (size > m_capacity)
+            throw std::bad_alloc();
+
+        // Committing pages another process already committed is harmless
+        if (size > m_committedSize) {
+            commitRange(static_cast<std::byte*>(m_view.address()) + m_committedSize,
+                        size - m_committedSize, m_placement);
+            m_committedSize = size;
+        }
+        m_size = size;
+    }
+    void advise(size_t offset, size_t length, access_pattern pattern) const {
+        adviseRange(data(), m_size, offset, length, pattern);
+    }
+
+private:
+    static HANDLE duplicate(HANDLE handle) {
+        HANDLE result;
+        if (!DuplicateHandle(GetCurrentProcess(), handle, GetCurrentProcess(), &result, 0, FALSE,
+                             DUPLICATE_SAME_ACCESS))
+            throw LastError();
+        return result;
+    }
+    size_t            m_capacity = 0;
+    numa_placement    m_placement;
+    size_t            m_size = 0;
+    size_t            m_committedSize = 0;
+    FileMappingHandle m_mapping;
+    FileMappingView   m_view;
+};
+
+static_assert(std::is_move_constructible_v<ResizableSharedMemory>);
+static_assert(std::is_move_assignable_v<ResizableSharedMemory>);
+
+// Circular buffer whose memory is mapped twice back to back, so data()[i] and
+// data()[i + capacity()] are the same byte. Reads and writes of up to capacity() bytes starting
+// anywhere in the first copy are contiguous across the wrap point, with no copying. The capacity
+// is rounded up to the allocation granularity. Backed by the paging file or, for persistent
+// queues, a file. Read and write positions are left to the caller, e.g. stored in a separate
+// header.
+class RingBuffer {
+public:
+    RingBuffer(size_t minCapacity)
+        : m_capacity(roundUp(minCapacity))
+        , m_mapping(nullptr, PAGE_READWRITE, m_capacity) {
+        mapMirrored();
+    }
+
+    // The file is grown to capacity() if needed and its existing contents are kept
+    RingBuffer(const fs::path& path, size_t minCapacity)
+        : m_capacity(roundUp(minCapacity))
+        , m_file(std::in_place, path, GENERIC_READ | GENERIC_WRITE,
+                 FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                 nullptr)
+        , m_mapping(*m_file, nullptr, PAGE_READWRITE, m_capacity) {
+        mapMirrored();
+    }
+    RingBuffer(RingBuffer&& other) noexcept = default;
+    RingBuffer& operator=(RingBuffer&& other) noexcept = default;
+    ~RingBuffer() {
+        if (m_file && *m_file && m_lower) {
+            flushView(m_lower->address(), m_capacity);
+            m_file->flush();
+        }
+    }
+
+    // Valid for 2 * capacity() bytes
+    void*  data() const { return m_lower ? m_lower->address() : nullptr; }
+    size_t capacity() const { return m_capacity; }
+
+    // Address of a position that wraps around, with at least capacity() contiguous bytes after it
+    void* at(size_t position) const {
+        return static_cast<std::byte*>(data()) + position % capacity();
+    }
+
+private:
+    static size_t roundUp(size_t size) {
+        size_t granularity = allocationGranularity();
+        size = std::max(size, granularity);
+        if (size > std::numeric_limits<size_t>::max() / 2 - granularity)
+            throw std::bad_alloc();
+        return ((size + granularity - 1) / granularity) * granularity;
+    }
+
+    // Find a free range twice the size by reserving and releasing it, then map both views into
+    // it. Another thread may allocate in the range in between, so retry a few times.
+    void mapMirrored() {
+        for (int attempt = 0; attempt < 16; ++attempt) {
+            void* base = VirtualAlloc(nullptr, 2 * m_capacity, MEM_RESERVE, PAGE_NOACCESS);
+            if (!base)
+                throw LastError();
+            VirtualFree(base, 0, MEM_RELEASE);
+            try {
+                m_lower.emplace(m_mapping, FILE_MAP_WRITE, 0, m_capacity, base);
+                m_upper.emplace(m_mapping, FILE_MAP_WRITE, 0, m_capacity,
+                                static_cast<std::byte*>(base) + m_capacity);
+                return;
+            } catch (const mapping_error&) {
+                m_upper.reset();
+                m_lower.reset();
+            }
+        }
+        throw mapping_error("failed to map ring buffer views back to back");
+    }
+    size_t                         m_capacity;
+    std::optional<FileHandle>      m_file;
+    FileMappingHandle              m_mapping;
+    std::optional<FileMappingView> m_lower;
+    std::optional<FileMappingView> m_upper;
+};
+
+static_assert(std::is_move_constructible_v<RingBuffer>);
+static_assert(std::is_move_assignable_v<RingBuffer>);
+
 } // namespace detail
 
 } // namespace decodeless
@@ -0,0 +1,301 @@
+// Copyright (c) 2024 Pyarelal Knowles, MIT License
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <decodeless/detail/mappedfile_linux.hpp>
+#include <deque>
+#include <exception>
+#include <future>
+#include <linux/io_uring.h>
+#include <memory>
+#include <mutex>
+#include <string.h>
+#include <sys/syscall.h>
+#include <vector>
+
+namespace decodeless {
+
+namespace detail {
+
+// Minimal io_uring submission and completion queues using raw syscalls, to avoid a liburing
+// dependency. Not thread safe. Only the thread that owns it may queue, submit and reap.
+class IoUring {
+public:
+    IoUring(unsigned entries)
+        : m_fd(setup(entries, m_params))
+        , m_sqRing(nullptr, m_params.sq_off.array + m_params.sq_entries * sizeof(unsigned),
+                   MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING)
+        , m_cqRing(nullptr, m_params.cq_off.cqes + m_params.cq_entries * sizeof(io_uring_cqe),
+                   MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING)
+        , m_sqes(nullptr, m_params.sq_entries * sizeof(io_uring_sqe), MAP_SHARED | MAP_POPULATE,
+                 m_fd, IORING_OFF_SQES) {
+        // The rings are not files. There is nothing to sync.
+        m_sqRing.setUnmapSync(0);
+        m_cqRing.setUnmapSync(0);
+        m_sqes.setUnmapSync(0);
+        m_sqTail = *ringField(m_sqRing, m_params.sq_off.tail);
+    }
+    IoUring(const IoUring& other) = delete;
+    IoUring& operator=(const IoUring& other) = delete;
+
+    unsigned entries() const { return m_params.sq_entries; }
+    unsigned features() const { return m_params.features; }
+
+    // Returns a zeroed submission queue entry to fill in, or nullptr if the queue is full. It is
+    // passed to the kernel by the next submit().
+    io_uring_sqe* queue() {
+        unsigned head = std::atomic_ref(*ringField(m_sqRing, m_params.sq_off.head))
+                            .load(std::memory_order_acquire);
+        if (m_sqTail - head >= m_params.sq_entries)
+            return nullptr;
+        unsigned index = m_sqTail++ & *ringField(m_sqRing, m_params.sq_off.ring_mask);
+        ringField(m_sqRing, m_params.sq_off.array)[index] = index;
+        io_uring_sqe* sqe = static_cast<io_uring_sqe*>(m_sqes.address()) + index;
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    // Passes queued entries to the kernel and waits for at least minComplete completions
+    void submit(unsigned minComplete) {
+        unsigned* tail = ringField(m_sqRing, m_params.sq_off.tail);
+        std::atomic_ref(*tail).store(m_sqTail, std::memory_order_release);
+        for (;;) {
+            // Entries the kernel has not consumed yet, e.g. after being interrupted
+            unsigned head = std::atomic_ref(*ringField(m_sqRing, m_params.sq_off.head))
+                                .load(std::memory_order_acquire);
+            if (syscall(__NR_io_uring_enter, int(m_fd), m_sqTail - head, minComplete,
+                        minComplete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0) != -1)
+                return;
+            if (errno != EINTR && errno != EAGAIN)
+                throw LastError();
+        }
+    }
+
+    // Calls callback for each available completion queue entry, consuming them
+    template <class Callback>
+    void reap(Callback&& callback) {
+        unsigned* headPtr = ringField(m_cqRing, m_params.cq_off.head);
+        unsigned  head = *headPtr;
+        unsigned  tail = std::atomic_ref(*ringField(m_cqRing, m_params.cq_off.tail))
+                            .load(std::memory_order_acquire);
+        unsigned  mask = *ringField(m_cqRing, m_params.cq_off.ring_mask);
+        auto*     cqes = reinterpret_cast<const io_uring_cqe*>(
+            static_cast<std::byte*>(m_cqRing.address()) + m_params.cq_off.cqes);
+        for (; head != tail; ++head)
+            callback(cqes[head & mask]);
+        std::atomic_ref(*headPtr).store(head, std::memory_order_release);
+    }
+
+private:
+    static int setup(unsigned entries, io_uring_params& params) {
+        params = {};
+        return int(syscall(__NR_io_uring_setup, entries, &params));
+    }
+    static unsigned* ringField(const MemoryMapRW& ring, unsigned offset) {
+        return reinterpret_cast<unsigned*>(static_cast<std::byte*>(ring.address()) + offset);
+    }
+    io_uring_params m_params;
+    FileDescriptor  m_fd;
+    MemoryMapRW     m_sqRing;
+    MemoryMapRW     m_cqRing;
+    MemoryMapRW     m_sqes;
+    unsigned        m_sqTail;
+};
+
+// Warms ranges of a MappedFile in the background by reading them into the page cache with
+// io_uring, keeping up to queueDepth chunk sized reads in flight at once. Each prefetch() returns
+// a future that is ready once the range is cached, after which touching it takes only minor
+// faults. If io_uring is unavailable, e.g. disabled by the kernel.io_uring_disabled sysctl, the
+// ranges are prefaulted one chunk at a time on the background thread instead. The mapping must
+// outlive the prefetcher. Requests still pending on destruction are cancelled, setting
+// mapping_error on their futures.
+class Prefetcher {
+public:
+    template <bool Writable, file_policy Policy>
+    Prefetcher(const MappedFile<Writable, Policy>& mapping, unsigned queueDepth = 32,
+               size_t chunkSize = 256 * 1024)
+        : m_address(mapping.data())
+        , m_size(mapping.size())
+        , m_fd(mapping.nativeFile())
+        , m_fileOffset(mapping.offset())
+        , m_queueDepth(std::max(queueDepth, 1u))
+        , m_chunkSize(std::clamp(chunkSize - chunkSize % pageSize(), size_t(pageSize()),
+                                 size_t(std::numeric_limits<unsigned>::max()) / 2))
+        , m_ring(openRing(m_queueDepth))
+        , m_buffer(m_ring ? std::make_unique<std::byte[]>(m_chunkSize) : nullptr)
+        , m_worker([this](std::stop_token stop) { run(stop); }) {
+        if (m_ring)
+            m_queueDepth = std::min(m_queueDepth, m_ring->entries());
+    }
+    Prefetcher(const Prefetcher& other) = delete;
+    Prefetcher& operator=(const Prefetcher& other) = delete;
+
+    // Queues [offset, offset + length) of the mapping to be cached. Requests are started in the
+    // order they are made.
+    std::future<void> prefetch(size_t offset, size_t length) {
+        auto [begin, end] = pageRange(m_size, offset, length, pageSize());
+        auto              request = std::make_unique<Request>();
+        std::future<void> result = request->done.get_future();
+        if (begin == end) {
+            request->done.set_value();
+            return result;
+        }
+        request->next = begin;
+        request->end = end;
+        {
+            std::lock_guard lock(m_mutex);
+            m_pending.push_back(std::move(request));
+        }
+        m_wake.notify_one();
+        return result;
+    }
+
+    // False if falling back to prefaulting because io_uring is unavailable
+    bool asynchronous() const { return m_ring != nullptr; }
+
+private:
+    struct Request {
+        std::promise<void> done;
+        size_t             next = 0;
+        size_t             end = 0;
+        unsigned           inflight = 0;
+        std::exception_ptr error;
+    };
+    struct Chunk {
+        Request* request;
+        size_t   offset;
+        size_t   length;
+    };
+
+    static std::unique_ptr<IoUring> openRing(unsigned entries) {
+        std::unique_ptr<IoUring> result;
+        try {
+            result = std::make_unique<IoUring>(entries);
+
+            // IORING_OP_READ arrived in the same kernel as this feature flag
+            if (!(result->features() & IORING_FEAT_RW_CUR_POS))
+                result.reset();
+        } catch (const mapping_error&) {
+        }
+        return result;
+    }
+
+    static void finish(Request* request) {
+        std::unique_ptr<Request> owned(request);
+        if (owned->error)
+            owned->done.set_exception(owned->error);
+        else
+            owned->done.set_value();
+    }
+
+    // Takes up to capacity chunks from the front of the pending requests. Fully issued requests
+    // are owned by their chunks until the last one completes.
+    std::vector<Chunk> takeChunks(unsigned capacity) {
+        std::vector<Chunk> chunks;
+        while (!m_pending.empty() && chunks.size() < capacity) {
+            Request* request = m_pending.front().get();
+            size_t   length = std::min(m_chunkSize, request->end - request->next);
+            chunks.push_back({request, request->next, length});
+            request->next += length;
+            ++request->inflight;
+            if (request->next == request->end) {
+                (void)m_pending.front().release();
+                m_pending.pop_front();
+            }
+        }
+        return chunks;
+    }
+
+    void cancelPending() {
+        for (auto& request : m_pending) {
+            request->error = std::make_exception_ptr(mapping_error("prefetch cancelled"));
+            request->end = request->next;
+            if (request->inflight)
+                (void)request.release();
+            else
+                finish(request.release());
+        }
+        m_pending.clear();
+    }
+
+    void complete(Request* request, std::exception_ptr error) {
+        if (error && !request->error)
+            request->error = error;
+        if (--request->inflight == 0 && request->next == request->end)
+            finish(request);
+    }
+
+    void run(std::stop_token stop) {
+        unsigned inflight = 0;
+        for (;;) {
+            std::vector<Chunk> chunks;
+            {
+                std::unique_lock lock(m_mutex);
+                if (inflight == 0)
+                    m_wake.wait(lock, stop, [this] { return !m_pending.empty(); });
+                if (stop.stop_requested()) {
+                    cancelPending();
+                    if (inflight == 0)
+                        return;
+                } else {
+                    chunks = takeChunks(m_queueDepth - inflight);
+                }
+            }
+            if (!m_ring) {
+                for (const Chunk& chunk : chunks) {
+                    std::exception_ptr error;
+                    try {
+                        prefaultRange(m_address, m_size, chunk.offset, chunk.length);
+                    } catch (const mapping_error&) {
+                        error = std::current_exception();
+                    }
+                    complete(chunk.request, error);
+                }
+                continue;
+            }
+            for (const Chunk& chunk : chunks) {
+                // Never fails. inflight is limited to the queue size.
+                io_uring_sqe* sqe = m_ring->queue();
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = m_fd;
+                sqe->addr = reinterpret_cast<uint64_t>(m_buffer.get());
+                sqe->len = unsigned(chunk.length);
+                sqe->off = m_fileOffset + chunk.offset;
+                sqe->user_data = reinterpret_cast<uint64_t>(chunk.request);
+            }
+            inflight += unsigned(chunks.size());
+            m_ring->submit(1);
+            m_ring->reap([this, &inflight](const io_uring_cqe& cqe) {
+                --inflight;
+                complete(reinterpret_cast<Request*>(cqe.user_data),
+                         cqe.res < 0 ? std::make_exception_ptr(mapping_error(strerror(-cqe.res)))
+                                     : nullptr);
+            });
+        }
+    }
+
+    const void* m_address;
+    size_t      m_size;
+    int         m_fd;
+    size_t      m_fileOffset;
+    unsigned    m_queueDepth;
+    size_t      m_chunkSize;
+
+    // Reads are only needed for their side effect of filling the page cache, so every chunk is
+    // read into the same scratch buffer
+    std::unique_ptr<IoUring>             m_ring;
+    std::unique_ptr<std::byte[]>         m_buffer;
+    std::mutex                           m_mutex;
+    std::condition_variable_any          m_wake;
+    std::deque<std::unique_ptr<Request>> m_pending;
+
+    // Declared last so it starts after and stops before everything it uses
+    std::jthread m_worker;
+};
+
+} // namespace detail
+
+} // namespace decodeless
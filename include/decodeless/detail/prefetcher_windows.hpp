@@ -0,0 +1,115 @@
+// Copyright (c) 2024 Pyarelal Knowles, MIT License
+
+#pragma once
+
+#include <condition_variable>
+#include <decodeless/detail/mappedfile_windows.hpp>
+#include <deque>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <vector>
+
+namespace decodeless {
+
+namespace detail {
+
+// Warms ranges of a MappedFile in the background. All ranges pending at once are passed to a
+// single PrefetchVirtualMemory() call so the I/O is issued in parallel, then each range's pages
+// are touched in request order. Each prefetch() returns a future that is ready once the range is
+// resident. The mapping must outlive the prefetcher. Requests still pending on destruction are
+// cancelled, setting mapping_error on their futures. queueDepth limits how many ranges are
+// prefetched together and chunkSize is accepted for parity with the io_uring implementation.
+class Prefetcher {
+public:
+    template <bool Writable, file_policy Policy>
+    Prefetcher(const MappedFile<Writable, Policy>& mapping, unsigned queueDepth = 32,
+               size_t chunkSize = 256 * 1024)
+        : m_address(mapping.data())
+        , m_size(mapping.size())
+        , m_queueDepth(std::max(queueDepth, 1u))
+        , m_worker([this](std::stop_token stop) { run(stop); }) {
+        (void)chunkSize;
+    }
+    Prefetcher(const Prefetcher& other) = delete;
+    Prefetcher& operator=(const Prefetcher& other) = delete;
+
+    // Queues [offset, offset + length) of the mapping to be made resident. Requests are started
+    // in the order they are made.
+    std::future<void> prefetch(size_t offset, size_t length) {
+        auto [begin, end] = pageRange(m_size, offset, length, pageSizeCached());
+        Request           request{.begin = begin, .end = end};
+        std::future<void> result = request.done.get_future();
+        if (begin == end) {
+            request.done.set_value();
+            return result;
+        }
+        {
+            std::lock_guard lock(m_mutex);
+            m_pending.push_back(std::move(request));
+        }
+        m_wake.notify_one();
+        return result;
+    }
+
+    // PrefetchVirtualMemory() always issues its reads asynchronously
+    bool asynchronous() const { return true; }
+
+private:
+    struct Request {
+        size_t             begin;
+        size_t             end;
+        std::promise<void> done;
+    };
+
+    void run(std::stop_token stop) {
+        auto* bytes = reinterpret_cast<std::byte*>(const_cast<void*>(m_address));
+        for (;;) {
+            std::vector<Request> requests;
+            {
+                std::unique_lock lock(m_mutex);
+                m_wake.wait(lock, stop, [this] { return !m_pending.empty(); });
+                if (stop.stop_requested()) {
+                    for (Request& request : m_pending)
+                        request.done.set_exception(
+                            std::make_exception_ptr(mapping_error("prefetch cancelled")));
+                    m_pending.clear();
+                    return;
+                }
+                while (!m_pending.empty() && requests.size() < m_queueDepth) {
+                    requests.push_back(std::move(m_pending.front()));
+                    m_pending.pop_front();
+                }
+            }
+            std::vector<WIN32_MEMORY_RANGE_ENTRY> ranges;
+            for (const Request& request : requests)
+                ranges.push_back({.VirtualAddress = bytes + request.begin,
+                                  .NumberOfBytes = request.end - request.begin});
+            std::exception_ptr error;
+            if (!PrefetchVirtualMemory(GetCurrentProcess(), ranges.size(), ranges.data(), 0))
+                error = std::make_exception_ptr(LastError());
+            for (Request& request : requests) {
+                if (error) {
+                    request.done.set_exception(error);
+                    continue;
+                }
+                touchPages(bytes + request.begin, bytes + request.end, pageSizeCached());
+                request.done.set_value();
+            }
+        }
+    }
+
+    const void*                 m_address;
+    size_t                      m_size;
+    unsigned                    m_queueDepth;
+    std::mutex                  m_mutex;
+    std::condition_variable_any m_wake;
+    std::deque<Request>         m_pending;
+
+    // Declared last so it starts after and stops before everything it uses
+    std::jthread m_worker;
+};
+
+} // namespace detail
+
+} // namespace decodeless
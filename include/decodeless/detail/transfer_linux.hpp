@@ -0,0 +1,38 @@
+// Copyright (c) 2024 Pyarelal Knowles, MIT License
+
+#pragma once
+
+#include <decodeless/detail/mappedfile_linux.hpp>
+#include <sys/sendfile.h>
+
+namespace decodeless {
+
+namespace detail {
+
+using SocketHandle = int;
+
+// Sends up to length bytes from offset in source to a connected socket with sendfile(), which
+// reads straight from the page cache. Returns the bytes sent. That is less than length if the
+// source ends early or, for a non-blocking socket, if it would block.
+inline size_t sendFileRange(const FileDescriptor& source, size_t offset, SocketHandle socket,
+                            size_t length) {
+    off_t  in = off_t(offset);
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t result = sendfile(socket, source, &in, length - sent);
+        if (result == -1 && errno == EINTR)
+            continue;
+        if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (result == -1)
+            throw LastError();
+        if (result == 0)
+            break; // the source was truncated
+        sent += size_t(result);
+    }
+    return sent;
+}
+
+} // namespace detail
+
+} // namespace decodeless
@@ -0,0 +1,75 @@
+// Copyright (c) 2024 Pyarelal Knowles, MIT License
+
+#pragma once
+
+#include <decodeless/detail/mappedfile_windows.hpp>
+
+namespace decodeless {
+
+namespace detail {
+
+// SOCKET, without including winsock2.h, which conflicts with windows.h unless WIN32_LEAN_AND_MEAN
+// is defined first
+using SocketHandle = UINT_PTR;
+
+// TransmitFile() from mswsock.dll, resolved at runtime so users need not link mswsock.lib. The
+// last two parameters are TRANSMIT_FILE_BUFFERS* and flags, which are unused here.
+class Mswsock {
+public:
+    using TransmitFileType = BOOL WINAPI(SocketHandle, HANDLE, DWORD, DWORD, LPOVERLAPPED, void*,
+                                         DWORD);
+    Mswsock()
+        : m_mswsock("mswsock.dll")
+        , m_TransmitFile(m_mswsock.get<TransmitFileType>("TransmitFile")) {}
+
+private:
+    DynamicLibrary m_mswsock;
+
+public:
+    TransmitFileType* const m_TransmitFile;
+};
+
+// Resolved on first use and shared by the whole program, like ntifs()
+inline const Mswsock& mswsock() {
+    static const Mswsock mswsock;
+    return mswsock;
+}
+
+// Windows has no in-kernel copy between arbitrary ranges of two files. CopyFileEx() only copies
+// whole files and block cloning needs ReFS. Returns 0 so the caller writes from the mapping.
+inline size_t copyFileRange(const FileHandle&, size_t, const FileHandle&, size_t, size_t) {
+    return 0;
+}
+
+// Sends up to length bytes from offset in source to a connected socket with TransmitFile(), which
+// reads straight from the file cache, waiting for each call to complete. Returns the bytes sent.
+inline size_t sendFileRange(const FileHandle& source, size_t offset, SocketHandle socket,
+                            size_t length) {
+    HANDLE event = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!event)
+        throw LastError();
+    Handle eventHandle(std::move(event));
+    size_t sent = 0;
+    while (sent < length) {
+        // Each call sends at most 2^31 - 2 bytes
+        DWORD      chunk = DWORD(std::min(length - sent, size_t(0x7ffffffe)));
+        OVERLAPPED position{};
+        position.Offset = DWORD(offset + sent);
+        position.OffsetHigh = DWORD((offset + sent) >> 32);
+        position.hEvent = eventHandle;
+        if (!mswsock().m_TransmitFile(socket, source, chunk, 0, &position, nullptr, 0) &&
+            GetLastError() != ERROR_IO_PENDING)
+            throw LastError();
+        DWORD transferred = 0;
+        if (!GetOverlappedResult(reinterpret_cast<HANDLE>(socket), &position, &transferred, TRUE))
+            throw LastError();
+        if (transferred == 0)
+            break; // the source was truncated
+        sent += transferred;
+    }
+    return sent;
+}
+
+} // namespace detail
+
+} // namespace decodeless
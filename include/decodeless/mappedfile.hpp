@@ -22,8 +22,18 @@ namespace decodeless {
 // mapping_error)
 using file = detail::MappedFile<false>;
 using writable_file = detail::MappedFile<true>;
+template <file_policy Policy>
+using basic_file = detail::MappedFile<false, Policy>;
+template <file_policy Policy>
+using basic_writable_file = detail::MappedFile<true, Policy>;
 using resizable_file = detail::ResizableMappedFile;
+using streaming_file = detail::StreamingFile;
 using resizable_memory = detail::ResizableMappedMemory;
+using resizable_shared_memory = detail::ResizableSharedMemory;
+using mapped_window = detail::MappedWindow;
+using ring_buffer = detail::RingBuffer;
+using fault_scope = detail::FaultScope;
+using address_space_arena = detail::AddressSpaceArena;
 
 template <class T>
 concept move_only =
@@ -52,10 +62,46 @@ concept resizable_mapped_memory = move_only<T> && requires(T t) {
 };
 
 static_assert(mapped_file<file>);
+static_assert(std::is_constructible_v<file, fs::path, prefault>);
+static_assert(std::is_constructible_v<file, fs::path, size_t, size_t>);
 static_assert(writable_mapped_file<writable_file>);
+static_assert(std::is_constructible_v<writable_file, fs::path, durability>);
+static_assert(std::is_constructible_v<writable_file, fs::path, size_t, size_t>);
+static_assert(std::is_same_v<basic_writable_file<file_policy{}>, writable_file>);
+static_assert(writable_mapped_file<basic_writable_file<{.share = sharing::copy_on_write}>>);
+static_assert(mapped_file<basic_file<{.populate = true, .pages = page_size::transparent_huge}>>);
+static_assert(move_only<mapped_window>);
+static_assert(std::is_constructible_v<mapped_window, fs::path, size_t, size_t>);
+static_assert(move_only<ring_buffer>);
+static_assert(std::is_constructible_v<ring_buffer, size_t>);
+static_assert(std::is_constructible_v<ring_buffer, fs::path, size_t>);
 static_assert(resizable_mapped_memory<resizable_file>);
 static_assert(std::is_constructible_v<resizable_file, fs::path, size_t>);
+static_assert(
+    std::is_constructible_v<resizable_file, fs::path, size_t, growth_policy, durability>);
+static_assert(requires(resizable_file f) {
+    { f.reserve_append(size_t{}) } -> std::same_as<void*>;
+});
+static_assert(requires(const resizable_file f, const writable_file w) {
+    { f.snapshot(fs::path{}) } -> std::same_as<file>;
+    { w.snapshot(fs::path{}) } -> std::same_as<file>;
+});
+static_assert(
+    std::is_constructible_v<resizable_file, address_space_arena&, fs::path, size_t>);
+static_assert(resizable_mapped_memory<streaming_file>);
+static_assert(std::is_constructible_v<streaming_file, fs::path, size_t>);
 static_assert(resizable_mapped_memory<resizable_memory>);
 static_assert(std::is_constructible_v<resizable_memory, size_t, size_t>);
+static_assert(std::is_constructible_v<resizable_memory, size_t, size_t, page_size>);
+static_assert(
+    std::is_constructible_v<resizable_memory, size_t, size_t, page_size, size_t, numa_placement>);
+static_assert(
+    std::is_constructible_v<resizable_memory, address_space_arena&, size_t, size_t, page_size>);
+static_assert(resizable_mapped_memory<resizable_shared_memory>);
+static_assert(std::is_constructible_v<resizable_shared_memory, size_t, size_t>);
+static_assert(std::is_constructible_v<resizable_shared_memory, size_t, size_t, numa_placement>);
+static_assert(std::is_constructible_v<resizable_shared_memory,
+                                      resizable_shared_memory::native_handle_type, size_t, size_t,
+                                      void*>);
 
 } // namespace decodeless
@@ -0,0 +1,126 @@
+// Copyright (c) 2024 Pyarelal Knowles, MIT License
+
+#pragma once
+
+#include <decodeless/mappedfile.hpp>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace decodeless {
+
+// Thread safe cache of read-only file mappings for workloads that repeatedly open many files.
+// get() returns a shared mapping, reusing a cached one if the file has not been modified or
+// replaced since it was mapped. Least recently used mappings are evicted to stay within a budget
+// of mapped bytes and open files, preferring ones no caller references. Mappings still referenced
+// by callers are not counted against the budget once evicted, so the budget only limits what the
+// cache itself keeps alive, and getting one again maps the file again.
+class mapped_file_cache {
+public:
+    mapped_file_cache(size_t maxBytes = std::numeric_limits<size_t>::max(),
+                      size_t maxFiles = std::numeric_limits<size_t>::max())
+        : m_maxBytes(maxBytes)
+        , m_maxFiles(maxFiles) {}
+    mapped_file_cache(const mapped_file_cache& other) = delete;
+    mapped_file_cache& operator=(const mapped_file_cache& other) = delete;
+
+    // May throw the same errors as constructing a decodeless::file
+    std::shared_ptr<const file> get(const fs::path& path) {
+        // Check whether the file changed without holding the lock
+        detail::FileIdentity identity(path);
+        {
+            std::lock_guard lock(m_mutex);
+            if (auto cached = find(path.native(), identity))
+                return cached;
+        }
+
+        // Map the file without holding the lock so slow opens don't block other threads. If
+        // another thread raced to map the same file, use theirs.
+        auto            mapped = std::make_shared<const file>(path);
+        std::lock_guard lock(m_mutex);
+        if (auto cached = find(path.native(), identity))
+            return cached;
+        m_entries.push_front(Entry{path.native(), identity, mapped});
+        m_index.emplace(path.native(), m_entries.begin());
+        m_bytes += mapped->size();
+        evict();
+        return mapped;
+    }
+
+    // Drops the cached mapping of a file, if any
+    void erase(const fs::path& path) {
+        std::lock_guard lock(m_mutex);
+        if (auto it = m_index.find(path.native()); it != m_index.end())
+            erase(it->second);
+    }
+    void clear() {
+        std::lock_guard lock(m_mutex);
+        m_index.clear();
+        m_entries.clear();
+        m_bytes = 0;
+    }
+    size_t size() const {
+        std::lock_guard lock(m_mutex);
+        return m_entries.size();
+    }
+    size_t bytes() const {
+        std::lock_guard lock(m_mutex);
+        return m_bytes;
+    }
+
+private:
+    using key_type = fs::path::string_type;
+    struct Entry {
+        key_type                    key;
+        detail::FileIdentity        identity;
+        std::shared_ptr<const file> mapped;
+    };
+    using iterator = std::list<Entry>::iterator;
+
+    // Returns a cached mapping and marks it most recently used, or drops it if stale
+    std::shared_ptr<const file> find(const key_type& key, const detail::FileIdentity& identity) {
+        auto it = m_index.find(key);
+        if (it == m_index.end())
+            return nullptr;
+        if (!(it->second->identity == identity)) {
+            erase(it->second);
+            return nullptr;
+        }
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        return it->second->mapped;
+    }
+    void erase(iterator entry) {
+        m_bytes -= entry->mapped->size();
+        m_index.erase(entry->key);
+        m_entries.erase(entry);
+    }
+
+    // Evicts least recently used mappings until within budget. Unreferenced ones go first, as
+    // they are unmapped immediately. If that is not enough, the cache drops its reference to
+    // mappings callers still hold, which are unmapped when the last caller releases them.
+    void evict() {
+        auto it = m_entries.end();
+        while (overBudget() && it != m_entries.begin()) {
+            auto entry = std::prev(it);
+            if (entry->mapped.use_count() == 1)
+                erase(entry);
+            else
+                it = entry;
+        }
+        while (overBudget())
+            erase(std::prev(m_entries.end()));
+    }
+    bool overBudget() const {
+        return !m_entries.empty() && (m_bytes > m_maxBytes || m_entries.size() > m_maxFiles);
+    }
+    mutable std::mutex                     m_mutex;
+    std::list<Entry>                       m_entries;
+    std::unordered_map<key_type, iterator> m_index;
+    size_t                                 m_bytes = 0;
+    size_t                                 m_maxBytes;
+    size_t                                 m_maxFiles;
+};
+
+} // namespace decodeless
@@ -0,0 +1,107 @@
+// Copyright (c) 2024 Pyarelal Knowles, MIT License
+
+#pragma once
+
+#include <atomic>
+#include <decodeless/detail/crc32c.hpp>
+#include <decodeless/mappedfile.hpp>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace decodeless {
+
+// Splits a scan into chunks processed by a pool of threads. Page faults on a cold mapping are
+// mostly waiting on I/O, so more threads than cores can still help on fast storage.
+struct scan_options {
+    unsigned threads = 0;                 // 0 for std::thread::hardware_concurrency()
+    size_t   chunkSize = 4 * 1024 * 1024; // rounded up to a whole number of pages
+};
+
+namespace detail {
+
+// Calls chunk(index, offset, length) for each chunkSize chunk of [0, size) from options.threads
+// threads, including the caller. Rethrows the first exception after all threads finish.
+template <class Chunk>
+void parallelChunks(size_t size, const scan_options& options, Chunk&& chunk) {
+    size_t   chunkSize = options.chunkSize ? options.chunkSize : 1;
+    size_t   count = (size + chunkSize - 1) / chunkSize;
+    unsigned threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+    threads = unsigned(std::clamp(size_t(threads), size_t(1), std::max(count, size_t(1))));
+    std::atomic<size_t> next = 0;
+    std::exception_ptr  error;
+    std::mutex          errorMutex;
+    auto                work = [&] {
+        for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+            try {
+                chunk(i, i * chunkSize, std::min(chunkSize, size - i * chunkSize));
+            } catch (...) {
+                std::lock_guard lock(errorMutex);
+                if (!error)
+                    error = std::current_exception();
+                next.store(count, std::memory_order_relaxed); // stop the other threads early
+            }
+        }
+    };
+    {
+        std::vector<std::jthread> pool;
+        for (unsigned i = 1; i < threads; ++i)
+            pool.emplace_back(work);
+        work();
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+inline scan_options pageAligned(scan_options options) {
+    size_t ps = pageSize();
+    options.chunkSize = std::max((options.chunkSize + ps - 1) / ps * ps, ps);
+    return options;
+}
+
+} // namespace detail
+
+// Faults in size bytes at data, e.g. a freshly opened file's data() and size(), in parallel
+inline void parallel_prefault(const void* data, size_t size, scan_options options = {}) {
+    options = detail::pageAligned(options);
+    detail::parallelChunks(size, options, [data, size](size_t, size_t offset, size_t length) {
+        detail::prefaultRange(data, size, offset, length);
+    });
+}
+
+// Returns the CRC-32C of size bytes at data, computed in parallel. The result is the same as a
+// sequential CRC-32C, e.g. from SSE4.2 crc32 instructions or other libraries. It uses hardware
+// instructions when available and faults in the pages as a side effect.
+inline uint32_t parallel_crc32c(const void* data, size_t size, scan_options options = {}) {
+    options = detail::pageAligned(options);
+    std::vector<uint32_t> crcs((size + options.chunkSize - 1) / options.chunkSize);
+    detail::parallelChunks(size, options, [data, &crcs](size_t index, size_t offset,
+                                                        size_t length) {
+        crcs[index] = detail::crc32c(0, static_cast<const std::byte*>(data) + offset, length);
+    });
+    uint32_t result = 0;
+    uint32_t shift = detail::crc32cShift(options.chunkSize);
+    for (size_t i = 0; i < crcs.size(); ++i) {
+        size_t length = std::min(options.chunkSize, size - i * options.chunkSize);
+        result = detail::crc32cCombine(
+            result, crcs[i], length == options.chunkSize ? shift : detail::crc32cShift(length));
+    }
+    return result;
+}
+
+// Convenience overloads for mapping objects with data() and size()
+template <class Mapping>
+void parallel_prefault(const Mapping& mapping, scan_options options = {})
+    requires requires { mapping.data(); mapping.size(); }
+{
+    parallel_prefault(mapping.data(), mapping.size(), options);
+}
+template <class Mapping>
+uint32_t parallel_crc32c(const Mapping& mapping, scan_options options = {})
+    requires requires { mapping.data(); mapping.size(); }
+{
+    return parallel_crc32c(mapping.data(), mapping.size(), options);
+}
+
+} // namespace decodeless
@@ -0,0 +1,21 @@
+// Copyright (c) 2024 Pyarelal Knowles, MIT License
+
+#pragma once
+
+#include <decodeless/mappedfile.hpp>
+#if defined(_WIN32)
+    #include <decodeless/detail/prefetcher_windows.hpp>
+#else
+    #include <decodeless/detail/prefetcher_linux.hpp>
+#endif
+
+namespace decodeless {
+
+// Asynchronously warms ranges of a file or writable_file. See detail::Prefetcher. May throw
+// std::bad_alloc or std::system_error if the background thread cannot be started.
+using prefetcher = detail::Prefetcher;
+
+static_assert(std::is_constructible_v<prefetcher, const file&>);
+static_assert(std::is_constructible_v<prefetcher, const writable_file&, unsigned, size_t>);
+
+} // namespace decodeless
@@ -0,0 +1,74 @@
+// Copyright (c) 2024 Pyarelal Knowles, MIT License
+
+#pragma once
+
+#include <decodeless/mappedfile.hpp>
+#if defined(_WIN32)
+    #include <decodeless/detail/transfer_windows.hpp>
+#else
+    #include <decodeless/detail/transfer_linux.hpp>
+#endif
+
+namespace decodeless {
+
+// A connected socket, i.e. int on Linux and SOCKET on Windows
+using native_socket = detail::SocketHandle;
+
+namespace detail {
+
+// File offset of a mapping's data(). Only file and writable_file may map part of a file.
+template <class Mapping>
+size_t fileOffset(const Mapping& mapping) {
+    if constexpr (requires { mapping.offset(); })
+        return mapping.offset();
+    else
+        return 0;
+}
+
+} // namespace detail
+
+// Copies [offset, offset + length) of source, clamped to its size(), to targetOffset in target,
+// growing target first if needed. The data is copied between the files in the kernel with
+// copy_file_range() where possible, without faulting in either mapping. Otherwise, e.g. across
+// filesystems on older Linux kernels and always on Windows, it is written to target from the
+// source mapping with resizable_file::write(), avoiding any intermediate buffer. Returns the
+// bytes copied. Throws std::bad_alloc if they don't fit in target's capacity().
+template <class Source>
+size_t copy_range(const Source& source, size_t offset, size_t length, resizable_file& target,
+                  size_t targetOffset)
+    requires requires { source.nativeFile(); }
+{
+    offset = std::min(offset, source.size());
+    length = std::min(length, source.size() - offset);
+    if (length == 0)
+        return 0;
+    if (targetOffset > target.capacity() || length > target.capacity() - targetOffset)
+        throw std::bad_alloc();
+    if (targetOffset + length > target.size())
+        target.resize(targetOffset + length);
+    size_t copied = detail::copyFileRange(source.nativeFile(), detail::fileOffset(source) + offset,
+                                          target.nativeFile(), targetOffset, length);
+    if (copied < length)
+        target.write(targetOffset + copied,
+                     static_cast<const std::byte*>(source.data()) + offset + copied,
+                     length - copied);
+    return length;
+}
+
+// Sends [offset, offset + length) of source, clamped to its size(), to a connected socket with
+// sendfile() / TransmitFile(), straight from the page cache rather than through a user space
+// buffer. Dirty pages of a writable mapping are included. Returns the bytes sent, which is less
+// than requested if a non-blocking socket on Linux would block. Call again for the rest.
+template <class Source>
+size_t send_range(const Source& source, size_t offset, size_t length, native_socket socket)
+    requires requires { source.nativeFile(); }
+{
+    offset = std::min(offset, source.size());
+    length = std::min(length, source.size() - offset);
+    if (length == 0)
+        return 0;
+    return detail::sendFileRange(source.nativeFile(), detail::fileOffset(source) + offset, socket,
+                                 length);
+}
+
+} // namespace decodeless
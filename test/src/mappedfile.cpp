@@ -1,12 +1,30 @@
 // Copyright (c) 2024 Pyarelal Knowles, MIT License
 
 #include <cstdio>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <gtest/gtest.h>
 #include <decodeless/mappedfile.hpp>
+#include <decodeless/mappedfile_cache.hpp>
+#include <decodeless/parallel_scan.hpp>
+#include <decodeless/prefetcher.hpp>
+#include <decodeless/transfer.hpp>
+#include <future>
+#include <optional>
 #include <ostream>
 #include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+    #include <signal.h>
+    #include <sys/resource.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/wait.h>
+#endif
 
 using namespace decodeless;
 
@@ -28,6 +46,439 @@ TEST_F(MappedFileFixture, ReadOnly) {
     EXPECT_EQ(*reinterpret_cast<const int*>(mapped.data()), 42);
 }
 
+TEST_F(MappedFileFixture, Writable) {
+    {
+        writable_file mapped(m_tmpFile);
+        EXPECT_EQ(*reinterpret_cast<const int*>(mapped.data()), 42);
+        *reinterpret_cast<int*>(mapped.data()) = 43;
+        mapped.flush(0, sizeof(int));
+    }
+    {
+        file mapped(m_tmpFile);
+        EXPECT_EQ(*reinterpret_cast<const int*>(mapped.data()), 43);
+    }
+    for (durability mode :
+         {durability::none, durability::async, durability::sync, durability::sync_on_close}) {
+        int value = 44 + int(mode);
+        {
+            writable_file mapped(m_tmpFile, mode);
+            *reinterpret_cast<int*>(mapped.data()) = value;
+        }
+        std::ifstream ifile(m_tmpFile, std::ios::binary);
+        int           contents;
+        ifile.read(reinterpret_cast<char*>(&contents), sizeof(contents));
+        EXPECT_EQ(contents, value);
+    }
+}
+
+TEST_F(MappedFileFixture, Policy) {
+    {
+        basic_writable_file<{.share = sharing::copy_on_write}> mapped(m_tmpFile);
+        *reinterpret_cast<int*>(mapped.data()) = 43;
+        EXPECT_EQ(*reinterpret_cast<const int*>(mapped.data()), 43);
+
+        // Other mappings still see the file
+        file other(m_tmpFile);
+        EXPECT_EQ(*reinterpret_cast<const int*>(other.data()), 42);
+    }
+    {
+        basic_file<{.populate = true, .pages = page_size::transparent_huge}> mapped(m_tmpFile);
+        EXPECT_EQ(*reinterpret_cast<const int*>(mapped.data()), 42);
+        EXPECT_GT(mapped.stats().resident, 0);
+    }
+    {
+        basic_writable_file<{.sync = durability::none}> mapped(m_tmpFile);
+        *reinterpret_cast<int*>(mapped.data()) = 44;
+    }
+    file mapped(m_tmpFile);
+    EXPECT_EQ(*reinterpret_cast<const int*>(mapped.data()), 44);
+}
+
+TEST_F(MappedFileFixture, Advise) {
+    file mapped(m_tmpFile);
+    for (access_pattern pattern : {access_pattern::sequential, access_pattern::random,
+                                   access_pattern::willneed, access_pattern::dontneed,
+                                   access_pattern::normal}) {
+        EXPECT_NO_THROW(mapped.advise(0, mapped.size(), pattern));
+        EXPECT_EQ(*reinterpret_cast<const int*>(mapped.data()), 42);
+    }
+
+    // Out of range hints are clamped
+    EXPECT_NO_THROW(mapped.advise(1, 1000000, access_pattern::willneed));
+    EXPECT_NO_THROW(mapped.advise(1000000, 1, access_pattern::willneed));
+
+    resizable_memory memory(detail::pageSize() * 4, detail::pageSize() * 16);
+    EXPECT_NO_THROW(memory.advise(0, memory.size(), access_pattern::sequential));
+    reinterpret_cast<uint8_t*>(memory.data())[0] = 1;
+    EXPECT_NO_THROW(memory.advise(0, memory.size(), access_pattern::dontneed));
+    EXPECT_NO_THROW(memory.advise(0, memory.size(), access_pattern::willneed));
+    reinterpret_cast<uint8_t*>(memory.data())[memory.size() - 1] = 1;
+}
+
+TEST_F(MappedFileFixture, Window) {
+    fs::path tmpFile2 = fs::path{testing::TempDir()} / "test2.dat";
+    size_t   fileSize = 1024 * 1024 + 123;
+    {
+        std::ofstream ofile(tmpFile2, std::ios::binary);
+        for (size_t i = 0; i < fileSize; ++i)
+            ofile.put(char(i % 251));
+    }
+    {
+        mapped_window window(tmpFile2, 1000, 5);
+        EXPECT_EQ(window.fileSize(), fileSize);
+        auto check = [&] {
+            auto* bytes = reinterpret_cast<const uint8_t*>(window.data());
+            for (size_t i = 0; i < window.size(); ++i)
+                if (bytes[i] != uint8_t((window.offset() + i) % 251))
+                    return false;
+            return true;
+        };
+        EXPECT_EQ(window.offset(), 5);
+        EXPECT_EQ(window.size(), 1000);
+        EXPECT_TRUE(check());
+        for (size_t offset : {size_t(0), size_t(1), size_t(3000), size_t(70000), size_t(65536),
+                              size_t(500000), size_t(12345), fileSize - 1000}) {
+            window.seek(offset);
+            EXPECT_EQ(window.offset(), offset);
+            EXPECT_EQ(window.size(), 1000);
+            EXPECT_TRUE(check());
+        }
+
+        // The window is clamped at the end of the file
+        window.seek(fileSize - 10);
+        EXPECT_EQ(window.size(), 10);
+        EXPECT_TRUE(check());
+        window.seek(fileSize + 10);
+        EXPECT_EQ(window.size(), 0);
+        window.seek(42);
+        EXPECT_EQ(window.size(), 1000);
+        EXPECT_TRUE(check());
+
+        // Advice applies to the aligned pages under an unaligned window
+        window.advise(0, window.size(), access_pattern::willneed);
+        window.advise(10, 100, access_pattern::random);
+        window.seek(70001);
+        window.advise(0, window.size(), access_pattern::willneed);
+        EXPECT_TRUE(check());
+        window.seek(42);
+
+        mapped_window moved(std::move(window));
+        EXPECT_EQ(*reinterpret_cast<const uint8_t*>(moved.data()), 42);
+    }
+
+    // An empty file has an empty window wherever it is moved
+    std::ofstream(tmpFile2, std::ios::binary | std::ios::trunc).close();
+    {
+        mapped_window window(tmpFile2, 1000, 5);
+        EXPECT_EQ(window.fileSize(), 0);
+        EXPECT_EQ(window.size(), 0);
+        EXPECT_EQ(window.data(), nullptr);
+        window.seek(100000);
+        EXPECT_EQ(window.size(), 0);
+        window.advise(0, 1000, access_pattern::willneed);
+    }
+    fs::remove(tmpFile2);
+    EXPECT_FALSE(fs::exists(tmpFile2));
+}
+
+TEST_F(MappedFileFixture, Range) {
+    fs::path tmpFile2 = fs::path{testing::TempDir()} / "test2.dat";
+    size_t   fileSize = 256 * 1024 + 123;
+    {
+        std::ofstream ofile(tmpFile2, std::ios::binary);
+        for (size_t i = 0; i < fileSize; ++i)
+            ofile.put(char(i % 251));
+    }
+    {
+        file mapped(tmpFile2, 70001, 1000);
+        EXPECT_EQ(mapped.offset(), 70001);
+        EXPECT_EQ(mapped.size(), 1000);
+        auto* bytes = reinterpret_cast<const uint8_t*>(mapped.data());
+        EXPECT_EQ(bytes[0], uint8_t(70001 % 251));
+        EXPECT_EQ(bytes[999], uint8_t(71000 % 251));
+
+        // The range is clamped at the end of the file
+        file tail(tmpFile2, fileSize - 10, 1000);
+        EXPECT_EQ(tail.size(), 10);
+        EXPECT_EQ(reinterpret_cast<const uint8_t*>(tail.data())[9], uint8_t((fileSize - 1) % 251));
+    }
+    {
+        writable_file mapped(tmpFile2, 65536 + 3, 100);
+        reinterpret_cast<uint8_t*>(mapped.data())[0] = 0xff;
+        mapped.flush();
+    }
+    {
+        std::ifstream ifile(tmpFile2, std::ios::binary);
+        ifile.seekg(65536 + 2);
+        EXPECT_EQ(uint8_t(ifile.get()), uint8_t((65536 + 2) % 251));
+        EXPECT_EQ(uint8_t(ifile.get()), 0xff);
+    }
+    fs::remove(tmpFile2);
+}
+
+TEST_F(MappedFileFixture, Cache) {
+    fs::path tmpFile2 = fs::path{testing::TempDir()} / "test2.dat";
+    fs::path tmpFile3 = fs::path{testing::TempDir()} / "test3.dat";
+    auto     write = [](const fs::path& path, int value, size_t count) {
+        std::ofstream ofile(path, std::ios::binary);
+        for (size_t i = 0; i < count; ++i)
+            ofile.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    write(tmpFile2, 2, 1);
+    write(tmpFile3, 3, 1);
+    {
+        mapped_file_cache cache(1000, 2);
+        auto              a = cache.get(m_tmpFile);
+        EXPECT_EQ(*reinterpret_cast<const int*>(a->data()), 42);
+        EXPECT_EQ(cache.get(m_tmpFile), a);
+        EXPECT_EQ(cache.size(), 1);
+        EXPECT_EQ(cache.bytes(), sizeof(int));
+
+        // Modified files are mapped again. Windows can't write to a mapped file, so the mapping
+        // must be released first.
+        a.reset();
+#ifdef _WIN32
+        cache.erase(m_tmpFile);
+#endif
+        write(m_tmpFile, 43, 2);
+        auto b = cache.get(m_tmpFile);
+        EXPECT_EQ(b->size(), sizeof(int) * 2);
+        EXPECT_EQ(*reinterpret_cast<const int*>(b->data()), 43);
+        EXPECT_EQ(cache.size(), 1);
+        EXPECT_EQ(cache.bytes(), sizeof(int) * 2);
+        b.reset();
+
+        // The least recently used unreferenced file is evicted
+        auto c = cache.get(tmpFile2);
+        (void)cache.get(m_tmpFile);
+        (void)cache.get(tmpFile3);
+        EXPECT_EQ(cache.size(), 2);
+        EXPECT_EQ(cache.get(tmpFile2), c);
+        EXPECT_EQ(cache.size(), 2);
+        cache.erase(tmpFile2);
+        EXPECT_EQ(cache.size(), 1);
+        EXPECT_EQ(*reinterpret_cast<const int*>(c->data()), 2);
+        cache.clear();
+        EXPECT_EQ(cache.size(), 0);
+        EXPECT_EQ(cache.bytes(), 0);
+
+        EXPECT_THROW((void)cache.get(fs::path{testing::TempDir()} / "missing.dat"),
+                     mapped_file_error);
+    }
+    {
+        // Referenced mappings are evicted too when nothing else is left to evict, so the cache
+        // stays within budget while callers keep using them
+        mapped_file_cache cache(1000, 2);
+        auto              a = cache.get(m_tmpFile);
+        auto              b = cache.get(tmpFile2);
+        auto              c = cache.get(tmpFile3);
+        EXPECT_EQ(cache.size(), 2);
+        EXPECT_EQ(cache.bytes(), b->size() + c->size());
+        EXPECT_EQ(*reinterpret_cast<const int*>(a->data()), 43);
+        EXPECT_NE(cache.get(m_tmpFile), a);
+        EXPECT_EQ(cache.size(), 2);
+
+        mapped_file_cache small(sizeof(int) * 2);
+        auto              d = small.get(tmpFile2);
+        auto              e = small.get(m_tmpFile);
+        EXPECT_EQ(small.size(), 1);
+        EXPECT_EQ(small.bytes(), e->size());
+        EXPECT_EQ(*reinterpret_cast<const int*>(d->data()), 2);
+    }
+    {
+        mapped_file_cache        cache;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 8; ++t) {
+            threads.emplace_back([&, t] {
+                for (int i = 0; i < 100; ++i) {
+                    auto mapped = cache.get((t + i) % 2 ? tmpFile2 : tmpFile3);
+                    int  value = *reinterpret_cast<const int*>(mapped->data());
+                    EXPECT_TRUE(value == 2 || value == 3);
+                }
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+        EXPECT_EQ(cache.size(), 2);
+    }
+    fs::remove(tmpFile2);
+    fs::remove(tmpFile3);
+}
+
+TEST_F(MappedFileFixture, Prefault) {
+    {
+        file mapped(m_tmpFile, prefault{});
+        EXPECT_EQ(*reinterpret_cast<const int*>(mapped.data()), 42);
+    }
+    {
+        file mapped(m_tmpFile, prefault{.offset = 1, .length = 2});
+        EXPECT_EQ(*reinterpret_cast<const int*>(mapped.data()), 42);
+    }
+    {
+        file mapped(m_tmpFile, prefault{.background = true});
+        EXPECT_EQ(*reinterpret_cast<const int*>(mapped.data()), 42);
+
+        // Moving must keep the mapping alive for the background thread
+        file moved(std::move(mapped));
+        EXPECT_EQ(*reinterpret_cast<const int*>(moved.data()), 42);
+        moved = file(m_tmpFile, prefault{.background = true});
+        EXPECT_EQ(*reinterpret_cast<const int*>(moved.data()), 42);
+    }
+
+    // A larger file, destroyed before the background thread is likely done
+    fs::path tmpFile2 = fs::path{testing::TempDir()} / "test2.dat";
+    {
+        resizable_file writer(tmpFile2, 64 * 1024 * 1024);
+        writer.resize(64 * 1024 * 1024);
+        reinterpret_cast<uint8_t*>(writer.data())[writer.size() - 1] = 42;
+    }
+    {
+        file mapped(tmpFile2, prefault{.background = true});
+        EXPECT_EQ(reinterpret_cast<const uint8_t*>(mapped.data())[0], 0);
+    }
+    {
+        file mapped(tmpFile2, prefault{.offset = 32 * 1024 * 1024});
+        EXPECT_EQ(reinterpret_cast<const uint8_t*>(mapped.data())[mapped.size() - 1], 42);
+    }
+    fs::remove(tmpFile2);
+    EXPECT_FALSE(fs::exists(tmpFile2));
+}
+
+TEST_F(MappedFileFixture, Stats) {
+    {
+        writable_file mapped(m_tmpFile);
+        *reinterpret_cast<int*>(mapped.data()) = 43;
+        mapped.flush();
+        mapping_stats stats = mapped.stats();
+        EXPECT_EQ(stats.resident, size_t(detail::pageSize()));
+        EXPECT_EQ(stats.committed, sizeof(int));
+        EXPECT_EQ(stats.syncs.count, 1);
+        EXPECT_EQ(stats.resizes.count, 0);
+    }
+    {
+        size_t           ps = detail::pageSize();
+        resizable_memory memory(0, ps * 64);
+        fault_scope      scope;
+        memory.resize(ps * 4);
+        for (size_t i = 0; i < ps * 4; i += ps)
+            static_cast<uint8_t*>(memory.data())[i] = 1;
+        memory.resize(ps * 8);
+        memory.resize(ps);
+        mapping_stats stats = memory.stats();
+        EXPECT_EQ(stats.resizes.count, 3);
+        EXPECT_GE(stats.remaps.count, 2);
+        EXPECT_GT(stats.resizes.time.count(), 0);
+        EXPECT_EQ(stats.committed, ps);
+        EXPECT_EQ(stats.resident, ps);
+        EXPECT_EQ(stats.reserved, ps * 64);
+        EXPECT_GE(scope.faults().minor, 4);
+    }
+    {
+        // Opening may count as a resize or remap on some platforms, so compare deltas
+        resizable_file file(m_tmpFile, 1024 * 1024, growth_policy::exact(), durability::sync);
+        mapping_stats  before = file.stats();
+        file.resize(10000);
+        file.flush();
+        mapping_stats stats = file.stats();
+        EXPECT_EQ(stats.resizes.count - before.resizes.count, 1);
+        EXPECT_EQ(stats.syncs.count - before.syncs.count, 2);
+        EXPECT_EQ(stats.committed, 10000);
+        EXPECT_EQ(stats.reserved, 1024 * 1024);
+    }
+    {
+        mapped_window window(m_tmpFile, 16);
+        uint64_t      before = window.stats().remaps.count;
+        window.seek(1000000);
+        EXPECT_EQ(window.stats().remaps.count - before, 1);
+    }
+}
+
+TEST_F(MappedFileFixture, Prefetcher) {
+    {
+        file       mapped(m_tmpFile);
+        prefetcher warm(mapped);
+        EXPECT_NO_THROW(warm.prefetch(0, mapped.size()).get());
+        EXPECT_EQ(*reinterpret_cast<const int*>(mapped.data()), 42);
+
+        // Out of range requests are clamped and complete immediately
+        EXPECT_NO_THROW(warm.prefetch(1000000, 1).get());
+        EXPECT_NO_THROW(warm.prefetch(1, 1000000).get());
+    }
+
+    // Many chunks and more requests than the queue depth
+    fs::path tmpFile2 = fs::path{testing::TempDir()} / "test2.dat";
+    size_t   fileSize = 16 * 1024 * 1024;
+    {
+        resizable_file writer(tmpFile2, fileSize);
+        writer.resize(fileSize);
+        for (size_t i = 0; i < writer.size(); i += 4096)
+            reinterpret_cast<uint8_t*>(writer.data())[i] = uint8_t(i / 4096);
+    }
+    {
+        file                           mapped(tmpFile2);
+        prefetcher                     warm(mapped, 4, 64 * 1024);
+        std::vector<std::future<void>> results;
+        for (size_t offset = 0; offset < fileSize; offset += fileSize / 16)
+            results.push_back(warm.prefetch(offset, fileSize / 16));
+        for (auto& result : results)
+            EXPECT_NO_THROW(result.get());
+        for (size_t i = 0; i < mapped.size(); i += 4096)
+            EXPECT_EQ(reinterpret_cast<const uint8_t*>(mapped.data())[i], uint8_t(i / 4096));
+    }
+
+    // Destroyed with requests in flight. Futures are either done or cancelled.
+    {
+        std::vector<std::future<void>> results;
+        {
+            writable_file mapped(tmpFile2, durability::none);
+            prefetcher    warm(mapped, 2);
+            for (int i = 0; i < 8; ++i)
+                results.push_back(warm.prefetch(0, fileSize));
+        }
+        for (auto& result : results) {
+            try {
+                result.get();
+            } catch (const mapping_error&) {
+            }
+        }
+    }
+    fs::remove(tmpFile2);
+    EXPECT_FALSE(fs::exists(tmpFile2));
+}
+
+TEST(ParallelScan, Crc32c) {
+    EXPECT_EQ(detail::crc32c(0, "123456789", 9), 0xe3069283);
+    EXPECT_EQ(detail::crc32cSoftware(~0u, reinterpret_cast<const std::byte*>("123456789"), 9),
+              ~0xe3069283);
+    EXPECT_EQ(detail::crc32cCombine(detail::crc32c(0, "1234", 4), detail::crc32c(0, "56789", 5),
+                                    detail::crc32cShift(5)),
+              0xe3069283);
+
+    std::vector<uint8_t> bytes(detail::pageSize() * 37 + 123);
+    for (size_t i = 0; i < bytes.size(); ++i)
+        bytes[i] = uint8_t(i * 7 + i / 251);
+    uint32_t expected = detail::crc32c(0, bytes.data(), bytes.size());
+    EXPECT_EQ(~detail::crc32cSoftware(~0u, reinterpret_cast<const std::byte*>(bytes.data()),
+                                      bytes.size()),
+              expected);
+    for (unsigned threads : {1u, 3u, 0u})
+        for (size_t chunkSize : {size_t(1), size_t(detail::pageSize()) * 5, size_t(1) << 30})
+            EXPECT_EQ(parallel_crc32c(bytes.data(), bytes.size(), {threads, chunkSize}), expected);
+    EXPECT_EQ(parallel_crc32c(bytes.data(), 0), 0);
+}
+
+TEST_F(MappedFileFixture, ParallelScan) {
+    file mapped(m_tmpFile);
+    EXPECT_NO_THROW(parallel_prefault(mapped, {.threads = 4}));
+    EXPECT_EQ(parallel_crc32c(mapped), detail::crc32c(0, mapped.data(), mapped.size()));
+
+    resizable_memory memory(detail::pageSize() * 100, detail::pageSize() * 100);
+    memset(memory.data(), 0xab, memory.size());
+    EXPECT_NO_THROW(parallel_prefault(memory, {.threads = 4, .chunkSize = 1}));
+    EXPECT_EQ(parallel_crc32c(memory, {.threads = 4, .chunkSize = 1}),
+              detail::crc32c(0, memory.data(), memory.size()));
+}
+
 #ifdef _WIN32
 
 TEST_F(MappedFileFixture, FileHandle) {
@@ -117,6 +568,19 @@ TEST_F(MappedFileFixture, WinAllocationGranulairty) {
     EXPECT_GE(info.dwAllocationGranularity, 4096u);
 }
 
+TEST_F(MappedFileFixture, MappedSection) {
+    EXPECT_EQ(&detail::ntifs(), &detail::ntifs());
+    detail::FileHandle file(m_tmpFile, GENERIC_READ | GENERIC_WRITE,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL, nullptr);
+    detail::MappedSection<PAGE_READWRITE> mapped(
+        detail::ntifs(), SECTION_MAP_WRITE | SECTION_MAP_READ | SECTION_EXTEND_SIZE, sizeof(int),
+        SEC_COMMIT, file, 1024 * 1024, MEM_RESERVE);
+    EXPECT_EQ(*reinterpret_cast<int*>(mapped.view.address()), 42);
+    mapped.section.extend(detail::pageSize() * 2);
+    reinterpret_cast<uint8_t*>(mapped.view.address())[detail::pageSize() * 2 - 1] = 1;
+}
+
 #else
 
 TEST_F(MappedFileFixture, LinuxFileDescriptor) {
@@ -220,6 +684,88 @@ TEST_F(MappedFileFixture, LinuxResize) {
     EXPECT_FALSE(fs::exists(tmpFile2));
 }
 
+TEST(MemoryMap, LinuxResizeInPlace) {
+    size_t ps = detail::pageSize();
+
+    // Over a reservation, only the tail is mapped and unmapped
+    void* hint;
+    {
+        detail::MemoryMap<PROT_NONE> reserved(nullptr, ps * 4, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+                                              0);
+        hint = reserved.address();
+        detail::MemoryMapRW mapped(reserved.address(), ps, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS,
+                                   -1, 0);
+        *reinterpret_cast<int*>(mapped.address()) = 42;
+        mapped.resize(ps * 3, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        EXPECT_EQ(mapped.size(), ps * 3);
+        EXPECT_EQ(*reinterpret_cast<int*>(mapped.address()), 42);
+        reinterpret_cast<uint8_t*>(mapped.address())[ps * 3 - 1] = 1;
+        mapped.resize(ps, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        EXPECT_EQ(*reinterpret_cast<int*>(mapped.address()), 42);
+    }
+
+    // Without one, mremap() grows in place into free address space, e.g. where the reservation
+    // was, and never moves the mapping
+    detail::MemoryMapRW mapped(hint, ps, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    *reinterpret_cast<int*>(mapped.address()) = 43;
+    void* address = mapped.address();
+    if (address == hint) {
+        mapped.resize(ps * 4, 0, -1, 0);
+        EXPECT_EQ(mapped.address(), address);
+        EXPECT_EQ(mapped.size(), ps * 4);
+        reinterpret_cast<uint8_t*>(mapped.address())[ps * 4 - 1] = 1;
+    }
+    EXPECT_EQ(*reinterpret_cast<int*>(mapped.address()), 43);
+}
+
+TEST_F(MappedFileFixture, LinuxSendRange) {
+    int sockets[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    detail::FileDescriptor sender(sockets[0]);
+    detail::FileDescriptor receiver(sockets[1]);
+    {
+        writable_file mapped(m_tmpFile);
+        *reinterpret_cast<int*>(mapped.data()) = 43; // dirty pages are sent too
+        EXPECT_EQ(send_range(mapped, 0, 100, sender), sizeof(int));
+    }
+    int received = 0;
+    EXPECT_EQ(read(receiver, &received, sizeof(received)), ssize_t(sizeof(received)));
+    EXPECT_EQ(received, 43);
+
+    // Ranges are relative to data(), even for a mapping of part of a file
+    file mapped(m_tmpFile, 2, 2);
+    EXPECT_EQ(send_range(mapped, 1, 1, sender), 1);
+    uint8_t byte = 0;
+    EXPECT_EQ(read(receiver, &byte, 1), 1);
+    EXPECT_EQ(byte, reinterpret_cast<const uint8_t*>(&received)[3]);
+    EXPECT_EQ(send_range(mapped, 2, 1, sender), 0);
+}
+
+TEST_F(MappedFileFixture, LinuxReserveAppendFailure) {
+    // Make growing the file fail with EFBIG rather than raising SIGXFSZ
+    size_t ps = detail::pageSize();
+    rlimit original;
+    ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &original), 0);
+    auto previous = signal(SIGXFSZ, SIG_IGN);
+    {
+        resizable_file file(m_tmpFile, ps * 64);
+        (void)file.reserve_append(ps);
+        size_t size = file.size();
+        rlimit limited = original;
+        limited.rlim_cur = ps * 2;
+        ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &limited), 0);
+
+        // size() is restored so nothing past the end of the file is handed out
+        EXPECT_THROW((void)file.reserve_append(ps * 8), mapping_error);
+        EXPECT_EQ(file.size(), size);
+        ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &original), 0);
+        auto* bytes = static_cast<uint8_t*>(file.reserve_append(ps * 8));
+        EXPECT_EQ(bytes, static_cast<uint8_t*>(file.data()) + size);
+        bytes[ps * 8 - 1] = 1;
+    }
+    signal(SIGXFSZ, previous);
+}
+
 // TODO:
 // - MAP_HUGETLB
 // - MAP_HUGE_2MB, MAP_HUGE_1GB
@@ -299,6 +845,268 @@ TEST_F(MappedFileFixture, ResizeMemoryExtended) {
     }
 }
 
+TEST_F(MappedFileFixture, ResizeMemoryRelease) {
+    const size_t mb = 1024 * 1024;
+    for (size_t threshold : {size_t(0), 16 * mb}) {
+        resizable_memory memory(64 * mb, 64 * mb, page_size::normal, threshold);
+        uint8_t*         bytes = reinterpret_cast<uint8_t*>(memory.data());
+        bytes[0] = 1;
+        bytes[9 * mb] = 1;
+        bytes[32 * mb] = 1;
+
+        // Shrinking releases pages above the threshold, which read back as zero
+        memory.resize(1 * mb);
+        EXPECT_EQ(memory.size(), 1 * mb);
+        memory.resize(64 * mb);
+        EXPECT_EQ(memory.data(), bytes);
+        EXPECT_EQ(bytes[0], 1);
+        EXPECT_EQ(bytes[9 * mb], threshold ? 1 : 0);
+        EXPECT_EQ(bytes[32 * mb], 0);
+
+        memory.resize(0);
+        EXPECT_EQ(memory.size(), 0);
+        EXPECT_EQ(memory.data(), nullptr);
+        memory.resize(1);
+        EXPECT_EQ(memory.data(), bytes);
+        EXPECT_EQ(bytes[0], threshold ? 1 : 0);
+    }
+}
+
+#ifndef _WIN32
+// VmLck from /proc/self/status, the bytes the process has locked
+static size_t lockedBytes() {
+    std::ifstream status("/proc/self/status");
+    std::string   line;
+    while (std::getline(status, line))
+        if (line.starts_with("VmLck:"))
+            return std::stoull(line.substr(6)) * 1024;
+    return 0;
+}
+#endif
+
+TEST_F(MappedFileFixture, Lock) {
+    {
+        file mapped(m_tmpFile);
+        mapped.lock(0, mapped.size());
+        EXPECT_EQ(*reinterpret_cast<const int*>(mapped.data()), 42);
+        mapped.unlock(0, mapped.size());
+    }
+
+    // Locking to the end of a resizable_memory also locks pages it grows into. Sizes are kept
+    // small to stay within the default RLIMIT_MEMLOCK.
+    size_t           ps = detail::pageSize();
+    resizable_memory memory(ps, ps * 64);
+#ifndef _WIN32
+    size_t before = lockedBytes();
+#endif
+    memory.lock(0, memory.capacity());
+    memory.resize(ps * 4);
+    static_cast<uint8_t*>(memory.data())[ps * 3] = 1;
+#ifndef _WIN32
+    EXPECT_EQ(lockedBytes() - before, ps * 4);
+#endif
+    memory.unlock(0, memory.capacity());
+    memory.resize(ps * 8);
+#ifndef _WIN32
+    EXPECT_EQ(lockedBytes(), before);
+#endif
+    EXPECT_EQ(static_cast<uint8_t*>(memory.data())[ps * 3], 1);
+}
+
+TEST_F(MappedFileFixture, ResizeMemoryHugePages) {
+    for (page_size pages : {page_size::transparent_huge, page_size::huge_2mb}) {
+        std::optional<resizable_memory> memory;
+        try {
+            memory.emplace(1, 64 * 1024 * 1024 + 1, pages);
+        } catch (const mapping_error& e) {
+            // Explicit huge pages may not be available
+            EXPECT_NE(pages, page_size::transparent_huge) << e.what();
+            continue;
+        }
+        EXPECT_EQ(memory->size(), 1);
+        EXPECT_EQ(memory->capacity(), 64 * 1024 * 1024 + 1);
+        void* data = memory->data();
+#ifndef _WIN32
+        // Windows ignores transparent huge pages, so only aligns large pages
+        EXPECT_EQ(uintptr_t(data) % (2 * 1024 * 1024), 0);
+#endif
+        uint8_t* bytes = reinterpret_cast<uint8_t*>(data);
+        bytes[0] = 1;
+        for (size_t size = 3 * 1024 * 1024; size <= memory->capacity(); size += 3 * 1024 * 1024) {
+            memory->resize(size);
+            EXPECT_EQ(memory->data(), data);
+            EXPECT_EQ(memory->size(), size);
+            bytes[size - 1] = 2;
+            EXPECT_EQ(bytes[0], 1);
+        }
+        memory->resize(memory->capacity());
+        bytes[memory->capacity() - 1] = 3;
+        EXPECT_THROW(memory->resize(memory->capacity() + 1), std::bad_alloc);
+    }
+}
+
+TEST_F(MappedFileFixture, AddressSpaceArena) {
+    size_t              ps = detail::pageSize();
+    address_space_arena arena(ps * 64);
+    EXPECT_EQ(arena.available(), arena.size());
+    {
+        std::vector<resizable_memory> memories;
+        for (int i = 0; i < 4; ++i) {
+            memories.emplace_back(arena, ps, ps * 8);
+            std::fill_n(reinterpret_cast<uint8_t*>(memories.back().data()), ps, uint8_t(i));
+        }
+        resizable_file mapped(arena, m_tmpFile, ps * 16);
+        EXPECT_LE(arena.available(), arena.size() - ps * 48);
+        mapped.resize(ps * 2);
+        memories[1].resize(ps * 8);
+        for (int i = 0; i < 4; ++i)
+            EXPECT_EQ(reinterpret_cast<uint8_t*>(memories[i].data())[ps - 1], uint8_t(i));
+        EXPECT_EQ(*reinterpret_cast<int*>(mapped.data()), 42);
+
+        // Exhausted
+        EXPECT_THROW(resizable_memory(arena, 0, ps * 64), std::bad_alloc);
+
+        // Freed ranges are reused
+        memories.pop_back();
+        memories.emplace_back(arena, ps * 8, ps * 8);
+        EXPECT_EQ(reinterpret_cast<uint8_t*>(memories.back().data())[ps * 8 - 1], 0);
+    }
+    EXPECT_EQ(arena.available(), arena.size());
+    address_space_arena hugeArena(size_t(1) << 30);
+    resizable_memory    aligned(hugeArena, 0, size_t(8) << 20, page_size::transparent_huge);
+    aligned.resize(size_t(4) << 20);
+    reinterpret_cast<uint8_t*>(aligned.data())[aligned.size() - 1] = 1;
+
+    // Growing to a capacity that is not a whole number of huge pages stays within its own slot
+    resizable_memory partial(hugeArena, 0, size_t(3) << 20, page_size::transparent_huge);
+    resizable_memory neighbour(hugeArena, ps, ps);
+    reinterpret_cast<uint8_t*>(neighbour.data())[0] = 0xab;
+    partial.resize(partial.capacity());
+    reinterpret_cast<uint8_t*>(partial.data())[partial.size() - 1] = 1;
+    EXPECT_EQ(reinterpret_cast<uint8_t*>(neighbour.data())[0], 0xab);
+}
+
+TEST(ResizableSharedMemory, Share) {
+    size_t                  ps = detail::pageSize();
+    resizable_shared_memory memory(ps, ps * 64);
+    EXPECT_EQ(memory.size(), ps);
+    EXPECT_EQ(memory.capacity(), ps * 64);
+    auto* bytes = static_cast<uint8_t*>(memory.data());
+    bytes[0] = 42;
+    {
+        // A second mapping of the same memory sees writes from the first, including after growth
+        resizable_shared_memory other(memory.nativeHandle(), ps, ps * 64);
+        auto*                   otherBytes = static_cast<uint8_t*>(other.data());
+        EXPECT_NE(otherBytes, bytes);
+        EXPECT_EQ(otherBytes[0], 42);
+        memory.resize(ps * 10);
+        EXPECT_EQ(memory.data(), bytes);
+        bytes[ps * 10 - 1] = 43;
+        other.resize(ps * 10);
+        EXPECT_EQ(other.data(), otherBytes);
+        EXPECT_EQ(otherBytes[ps * 10 - 1], 43);
+        otherBytes[1] = 44;
+        EXPECT_EQ(bytes[1], 44);
+    }
+    EXPECT_THROW(memory.resize(ps * 65), std::bad_alloc);
+    memory.resize(ps);
+    EXPECT_EQ(bytes[1], 44);
+    memory.resize(ps * 2);
+    bytes[ps * 2 - 1] = 1;
+    memory.resize(0);
+    EXPECT_EQ(memory.data(), nullptr);
+}
+
+#ifndef _WIN32
+TEST(ResizableSharedMemory, Fork) {
+    size_t                  ps = detail::pageSize();
+    resizable_shared_memory memory(ps, ps * 64);
+    pid_t                   pid = fork();
+    ASSERT_NE(pid, -1);
+    if (pid == 0) {
+        // The child inherits the mapping at the same address
+        static_cast<uint8_t*>(memory.data())[0] = 42;
+        _exit(0);
+    }
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    EXPECT_EQ(static_cast<uint8_t*>(memory.data())[0], 42);
+}
+#endif
+
+TEST(RingBuffer, Mirrored) {
+    ring_buffer ring(1);
+    size_t      capacity = ring.capacity();
+    EXPECT_GE(capacity, size_t(detail::pageSize()));
+    auto* bytes = static_cast<uint8_t*>(ring.data());
+    bytes[0] = 42;
+    EXPECT_EQ(bytes[capacity], 42);
+    bytes[capacity + 1] = 43;
+    EXPECT_EQ(bytes[1], 43);
+
+    // A write across the wrap point is contiguous and lands at the start
+    uint32_t value = 0x01020304;
+    memcpy(ring.at(capacity * 3 - 2), &value, sizeof(value));
+    EXPECT_EQ(ring.at(capacity * 3 - 2), bytes + capacity - 2);
+    EXPECT_EQ(bytes[0], 0x02);
+    EXPECT_EQ(bytes[1], 0x01);
+
+    ring_buffer moved(std::move(ring));
+    EXPECT_EQ(moved.data(), bytes);
+    moved = ring_buffer(capacity + 1);
+    EXPECT_GT(moved.capacity(), capacity);
+}
+
+TEST_F(MappedFileFixture, RingBufferFile) {
+    fs::path tmpFile2 = fs::path{testing::TempDir()} / "test2.dat";
+    size_t   capacity;
+    {
+        ring_buffer ring(tmpFile2, 1);
+        capacity = ring.capacity();
+        uint32_t value = 42;
+        memcpy(ring.at(capacity - 2), &value, sizeof(value));
+    }
+    EXPECT_EQ(fs::file_size(tmpFile2), capacity);
+    {
+        ring_buffer ring(tmpFile2, 1);
+        uint32_t    value;
+        memcpy(&value, ring.at(capacity - 2), sizeof(value));
+        EXPECT_EQ(value, 42);
+    }
+    fs::remove(tmpFile2);
+    EXPECT_FALSE(fs::exists(tmpFile2));
+}
+
+TEST(NumaPlacement, ResizeMemory) {
+    size_t ps = detail::pageSize();
+    for (numa_placement placement :
+         {numa_placement::local(), numa_placement::bind(0), numa_placement::interleave(1),
+          numa_placement::preferred(0)}) {
+        resizable_memory memory(ps, ps * 64, page_size::normal, 0, placement);
+        static_cast<uint8_t*>(memory.data())[0] = 1;
+        memory.resize(ps * 32);
+        static_cast<uint8_t*>(memory.data())[ps * 32 - 1] = 1;
+#ifndef _WIN32
+        int           mode = -1;
+        unsigned long nodes = 0;
+        ASSERT_EQ(syscall(__NR_get_mempolicy, &mode, &nodes, sizeof(nodes) * 8 + 1,
+                          static_cast<uint8_t*>(memory.data()) + ps * 16, MPOL_F_ADDR),
+                  0);
+        EXPECT_EQ(mode, detail::mbindMode(placement.policy));
+#endif
+
+        resizable_shared_memory shared(ps, ps * 64, placement);
+        static_cast<uint8_t*>(shared.data())[0] = 1;
+        shared.resize(ps * 32);
+        static_cast<uint8_t*>(shared.data())[ps * 32 - 1] = 1;
+    }
+
+    // Nodes are a 64 bit mask
+    EXPECT_EQ(numa_placement::bind(63).nodes, uint64_t(1) << 63);
+    EXPECT_THROW(numa_placement::bind(64), mapping_error);
+    EXPECT_THROW(numa_placement::preferred(1000), mapping_error);
+}
+
 TEST_F(MappedFileFixture, ResizeFile) {
     fs::path   tmpFile2 = fs::path{testing::TempDir()} / "test2.dat";
     const char str[] = "hello world!";
@@ -404,6 +1212,389 @@ TEST_F(MappedFileFixture, ResizableFileSize) {
     EXPECT_EQ(fs::file_size(m_tmpFile), lastSize);
 }
 
+TEST_F(MappedFileFixture, ResizeFilePageBoundaries) {
+    fs::path tmpFile2 = fs::path{testing::TempDir()} / "test2.dat";
+    size_t   ps = detail::pageSize();
+    size_t   sizes[] = {1, ps - 1, ps, ps + 1, 3 * ps + 5, 3 * ps + 6, 4 * ps, 10 * ps - 1};
+    {
+        resizable_file file(tmpFile2, 16 * ps);
+        for (size_t size : sizes) {
+            file.resize(size);
+            reinterpret_cast<char*>(file.data())[size - 1] = char(size);
+            for (size_t previous : sizes) {
+                if (previous > size)
+                    break;
+                EXPECT_EQ(reinterpret_cast<char*>(file.data())[previous - 1], char(previous));
+            }
+        }
+    }
+    std::ifstream ifile(tmpFile2, std::ios::binary);
+    for (size_t size : sizes) {
+        ifile.seekg(size - 1);
+        EXPECT_EQ(char(ifile.get()), char(size));
+    }
+    ifile.close();
+    fs::remove(tmpFile2);
+    EXPECT_FALSE(fs::exists(tmpFile2));
+}
+
+TEST_F(MappedFileFixture, ResizeFileDurability) {
+    fs::path tmpFile2 = fs::path{testing::TempDir()} / "test2.dat";
+    for (durability mode :
+         {durability::none, durability::async, durability::sync, durability::sync_on_close}) {
+        {
+            resizable_file file(tmpFile2, 1024 * 1024, growth_policy::exact(), mode);
+            for (size_t size = 1000; size <= 100000; size += 1000) {
+                file.resize(size);
+                reinterpret_cast<uint8_t*>(file.data())[size - 1] = uint8_t(mode);
+            }
+            file.flush(0, 1000);
+            file.flush(50000, 1000000);
+            file.flush();
+            file.advise(0, file.size(), access_pattern::dontneed);
+            EXPECT_EQ(reinterpret_cast<uint8_t*>(file.data())[file.size() - 1], uint8_t(mode));
+        }
+        EXPECT_EQ(fs::file_size(tmpFile2), 100000);
+        std::ifstream ifile(tmpFile2, std::ios::binary);
+        ifile.seekg(100000 - 1);
+        EXPECT_EQ(ifile.get(), int(mode));
+        ifile.close();
+        fs::remove(tmpFile2);
+    }
+    EXPECT_FALSE(fs::exists(tmpFile2));
+}
+
+TEST_F(MappedFileFixture, ResizeFilePreallocate) {
+    fs::path tmpFile2 = fs::path{testing::TempDir()} / "test2.dat";
+    {
+        resizable_file file(tmpFile2, 64 * 1024 * 1024,
+                            growth_policy::chunked(1024 * 1024).preallocated());
+        file.resize(1000);
+        EXPECT_EQ(fs::file_size(tmpFile2), 1024 * 1024);
+#ifndef _WIN32
+        // Blocks are allocated rather than the file being sparse
+        struct stat info;
+        ASSERT_EQ(stat(tmpFile2.c_str(), &info), 0);
+        EXPECT_GE(size_t(info.st_blocks) * 512, 1024 * 1024);
+#endif
+        reinterpret_cast<uint8_t*>(file.data())[999] = 42;
+        file.resize(3 * 1024 * 1024 + 1);
+        EXPECT_EQ(fs::file_size(tmpFile2), 4 * 1024 * 1024);
+        EXPECT_EQ(reinterpret_cast<uint8_t*>(file.data())[999], 42);
+        reinterpret_cast<uint8_t*>(file.data())[file.size() - 1] = 43;
+    }
+    EXPECT_EQ(fs::file_size(tmpFile2), 3 * 1024 * 1024 + 1);
+    {
+        file mapped(tmpFile2);
+        EXPECT_EQ(reinterpret_cast<const uint8_t*>(mapped.data())[999], 42);
+        EXPECT_EQ(reinterpret_cast<const uint8_t*>(mapped.data())[mapped.size() - 1], 43);
+    }
+    fs::remove(tmpFile2);
+    EXPECT_FALSE(fs::exists(tmpFile2));
+}
+
+TEST_F(MappedFileFixture, ResizeFileWrite) {
+    size_t               ps = detail::pageSize();
+    std::vector<uint8_t> source(ps * 5 + 100);
+    for (size_t i = 0; i < source.size(); ++i)
+        source[i] = uint8_t(i % 251);
+    {
+        resizable_file mapped(m_tmpFile, ps * 16);
+        EXPECT_EQ(*reinterpret_cast<const int*>(mapped.data()), 42);
+
+        // Unaligned at both ends, growing the file
+        mapped.write(ps - 10, source.data(), source.size());
+        EXPECT_EQ(mapped.size(), ps - 10 + source.size());
+        EXPECT_EQ(*reinterpret_cast<const int*>(mapped.data()), 42);
+        EXPECT_EQ(memcmp(static_cast<uint8_t*>(mapped.data()) + ps - 10, source.data(),
+                         source.size()),
+                  0);
+
+        // Smaller than a page, within size()
+        mapped.write(1, source.data(), 2);
+        EXPECT_EQ(static_cast<uint8_t*>(mapped.data())[2], 1);
+        EXPECT_EQ(mapped.size(), ps - 10 + source.size());
+        EXPECT_THROW(mapped.write(ps * 16 - 1, source.data(), 2), std::bad_alloc);
+    }
+    std::ifstream ifile(m_tmpFile, std::ios::binary);
+    ifile.seekg(ps * 3);
+    EXPECT_EQ(uint8_t(ifile.get()), uint8_t((ps * 2 + 10) % 251));
+}
+
+TEST_F(MappedFileFixture, CopyRange) {
+    fs::path tmpFile2 = fs::path{testing::TempDir()} / "test2.dat";
+    size_t   ps = detail::pageSize();
+    {
+        resizable_file source(m_tmpFile, ps * 16);
+        source.resize(ps * 3);
+        for (size_t i = 0; i < source.size(); ++i)
+            static_cast<uint8_t*>(source.data())[i] = uint8_t(i % 251);
+
+        resizable_file target(tmpFile2, ps * 16);
+        EXPECT_EQ(copy_range(source, 10, ps * 2, target, ps), ps * 2);
+        EXPECT_EQ(target.size(), ps * 3);
+        EXPECT_EQ(memcmp(static_cast<uint8_t*>(target.data()) + ps,
+                         static_cast<uint8_t*>(source.data()) + 10, ps * 2),
+                  0);
+
+        // Clamped to the source and bounded by the target's capacity
+        file part(m_tmpFile, ps, ps * 16);
+        EXPECT_EQ(copy_range(part, ps, ps * 16, target, 0), ps);
+        EXPECT_EQ(static_cast<uint8_t*>(target.data())[0], uint8_t(ps * 2 % 251));
+        EXPECT_EQ(copy_range(part, ps * 2, 1, target, 0), 0);
+        EXPECT_THROW(copy_range(part, 0, ps, target, ps * 16), std::bad_alloc);
+    }
+    fs::remove(tmpFile2);
+}
+
+TEST(DirtyRanges, Merge) {
+    detail::DirtyRanges dirty;
+    dirty.mark(100, 10);
+    dirty.mark(0, 10);
+    dirty.mark(10, 5);  // touches the first
+    dirty.mark(105, 20); // overlaps the second
+    dirty.mark(50, 0);
+    EXPECT_EQ(dirty.ranges(), (std::vector<dirty_range>{{0, 15}, {100, 25}}));
+    dirty.mark(5, 200); // covers both
+    EXPECT_EQ(dirty.take(), (std::vector<dirty_range>{{0, 205}}));
+    EXPECT_TRUE(dirty.ranges().empty());
+}
+
+TEST_F(MappedFileFixture, FlushDirty) {
+    {
+        writable_file mapped(m_tmpFile);
+        EXPECT_TRUE(mapped.flush_dirty().empty());
+        *reinterpret_cast<int*>(mapped.data()) = 43;
+        mapped.mark_dirty(0, 1000); // clamped
+        EXPECT_EQ(mapped.dirty_ranges(), (std::vector<dirty_range>{{0, sizeof(int)}}));
+        EXPECT_EQ(mapped.flush_dirty(), (std::vector<dirty_range>{{0, sizeof(int)}}));
+        EXPECT_TRUE(mapped.dirty_ranges().empty());
+    }
+    {
+        resizable_file mapped(m_tmpFile, 1 << 20);
+        EXPECT_EQ(*reinterpret_cast<int*>(mapped.data()), 43);
+        mapped.resize(detail::pageSize() * 4);
+        reinterpret_cast<uint8_t*>(mapped.data())[detail::pageSize() * 2] = 1;
+        mapped.mark_dirty(detail::pageSize() * 2, 1);
+        mapped.mark_dirty(detail::pageSize() * 4, 1); // clamped away
+        EXPECT_EQ(mapped.flush_dirty(),
+                  (std::vector<dirty_range>{{size_t(detail::pageSize()) * 2, 1}}));
+    }
+}
+
+TEST_F(MappedFileFixture, Snapshot) {
+    fs::path snapshotFile = fs::path{testing::TempDir()} / "snapshot.dat";
+    {
+        resizable_file mapped(m_tmpFile, 1 << 20, growth_policy::geometric());
+        mapped.resize(sizeof(int) * 100);
+        int* numbers = reinterpret_cast<int*>(mapped.data());
+        for (int i = 0; i < 100; ++i)
+            numbers[i] = i;
+        file snapshot = mapped.snapshot(snapshotFile);
+        EXPECT_EQ(snapshot.size(), sizeof(int) * 100);
+
+        // Writes after the snapshot only change the original
+        numbers[50] = -1;
+        EXPECT_EQ(reinterpret_cast<const int*>(snapshot.data())[50], 50);
+        EXPECT_EQ(reinterpret_cast<const int*>(snapshot.data())[99], 99);
+    }
+    {
+        writable_file mapped(m_tmpFile, sizeof(int), sizeof(int) * 10);
+        file          snapshot = mapped.snapshot(snapshotFile);
+        EXPECT_EQ(snapshot.size(), sizeof(int) * 10);
+        EXPECT_EQ(reinterpret_cast<const int*>(snapshot.data())[0], 1);
+        reinterpret_cast<int*>(mapped.data())[0] = 7;
+        EXPECT_EQ(reinterpret_cast<const int*>(snapshot.data())[0], 1);
+    }
+    {
+        // Snapshotting onto the source, by name or through a hard link, would truncate it
+        fs::path       linkFile = fs::path{testing::TempDir()} / "snapshot_link.dat";
+        resizable_file mapped(m_tmpFile, 1 << 20);
+        fs::remove(linkFile);
+        fs::create_hard_link(m_tmpFile, linkFile);
+        EXPECT_THROW((void)mapped.snapshot(m_tmpFile), mapping_error);
+        EXPECT_THROW((void)mapped.snapshot(linkFile), mapping_error);
+        EXPECT_EQ(fs::file_size(m_tmpFile), mapped.size());
+        EXPECT_EQ(reinterpret_cast<const int*>(mapped.data())[99], 99);
+        fs::remove(linkFile);
+    }
+#ifndef _WIN32
+    // copy_file_range() fails with EXDEV between some filesystems, e.g. ext4 and tmpfs
+    struct stat tempStat;
+    struct stat shmStat;
+    if (stat(testing::TempDir().c_str(), &tempStat) == 0 && stat("/dev/shm", &shmStat) == 0 &&
+        tempStat.st_dev != shmStat.st_dev) {
+        fs::path otherFile = "/dev/shm/decodeless_snapshot.dat";
+        {
+            writable_file mapped(m_tmpFile, sizeof(int), sizeof(int) * 10);
+            file          snapshot = mapped.snapshot(otherFile);
+            EXPECT_EQ(snapshot.size(), sizeof(int) * 10);
+            EXPECT_EQ(reinterpret_cast<const int*>(snapshot.data())[0], 7);
+            EXPECT_EQ(reinterpret_cast<const int*>(snapshot.data())[9], 10);
+        }
+        {
+            resizable_file mapped(m_tmpFile, 1 << 20);
+            file           snapshot = mapped.snapshot(otherFile);
+            EXPECT_EQ(snapshot.size(), sizeof(int) * 100);
+            EXPECT_EQ(reinterpret_cast<const int*>(snapshot.data())[99], 99);
+        }
+        fs::remove(otherFile);
+    }
+#endif
+    fs::remove(snapshotFile);
+}
+
+TEST(GrowthPolicy, Sizes) {
+    EXPECT_EQ(growth_policy::exact()(100, 150, 1000), 150);
+    EXPECT_EQ(growth_policy::geometric()(100, 150, 1000), 200);
+    EXPECT_EQ(growth_policy::geometric()(100, 300, 1000), 300);
+    EXPECT_EQ(growth_policy::geometric()(600, 700, 1000), 1000);
+    EXPECT_EQ(growth_policy::geometric(2.0, 64)(100, 150, 1000), 256);
+    EXPECT_EQ(growth_policy::chunked(64)(0, 1, 1000), 64);
+    EXPECT_EQ(growth_policy::chunked(64)(0, 64, 1000), 64);
+    EXPECT_EQ(growth_policy::chunked(64)(0, 65, 1000), 128);
+    EXPECT_EQ(growth_policy::chunked(64)(0, 999, 1000), 1000);
+}
+
+TEST_F(MappedFileFixture, ResizeFileGrowthPolicy) {
+    fs::path tmpFile2 = fs::path{testing::TempDir()} / "test2.dat";
+    {
+        resizable_file file(tmpFile2, 1024 * 1024, growth_policy::geometric(2.0, 4096));
+        void*          data = nullptr;
+        for (size_t size = 1; size <= 100000; size += 1000) {
+            file.resize(size);
+            EXPECT_EQ(file.size(), size);
+            if (!data)
+                data = file.data();
+            EXPECT_EQ(file.data(), data);
+            reinterpret_cast<uint8_t*>(file.data())[size - 1] = uint8_t(size);
+            EXPECT_GE(fs::file_size(tmpFile2), size);
+        }
+        EXPECT_EQ(fs::file_size(tmpFile2), 131072);
+
+        // Shrinking is only bookkeeping until the file is closed
+        file.resize(42);
+        EXPECT_EQ(file.size(), 42);
+        EXPECT_EQ(fs::file_size(tmpFile2), 131072);
+    }
+    EXPECT_EQ(fs::file_size(tmpFile2), 42);
+    {
+        resizable_file file(tmpFile2, 1024 * 1024, growth_policy::chunked(4096));
+        EXPECT_EQ(file.size(), 42);
+        EXPECT_EQ(reinterpret_cast<uint8_t*>(file.data())[0], 1);
+    }
+    fs::remove(tmpFile2);
+    EXPECT_FALSE(fs::exists(tmpFile2));
+}
+
+TEST_F(MappedFileFixture, ResizeFileConcurrentAppend) {
+    struct Record {
+        uint32_t thread;
+        uint32_t index;
+    };
+    constexpr uint32_t threads = 8;
+    constexpr uint32_t records = 10000;
+    fs::path           tmpFile2 = fs::path{testing::TempDir()} / "test2.dat";
+    {
+        resizable_file file(tmpFile2, 1024 * 1024, growth_policy::chunked(16384));
+        {
+            std::vector<std::jthread> writers;
+            for (uint32_t t = 0; t < threads; ++t) {
+                writers.emplace_back([&file, t] {
+                    for (uint32_t i = 0; i < records; ++i)
+                        *static_cast<Record*>(file.reserve_append(sizeof(Record))) = {t, i};
+                });
+            }
+        }
+        EXPECT_EQ(file.size(), threads * records * sizeof(Record));
+
+        // Every thread's records are present and in its own order
+        std::vector<uint32_t> next(threads, 0);
+        auto*                 all = static_cast<const Record*>(file.data());
+        for (size_t i = 0; i < threads * records; ++i) {
+            ASSERT_LT(all[i].thread, threads);
+            EXPECT_EQ(all[i].index, next[all[i].thread]++);
+        }
+        EXPECT_THROW(file.reserve_append(file.capacity()), std::bad_alloc);
+        EXPECT_EQ(file.size(), threads * records * sizeof(Record));
+    }
+    EXPECT_EQ(fs::file_size(tmpFile2), threads * records * sizeof(Record));
+    fs::remove(tmpFile2);
+    EXPECT_FALSE(fs::exists(tmpFile2));
+}
+
+TEST_F(MappedFileFixture, ResizeFileCommitted) {
+    constexpr uint32_t records = 100000;
+    fs::path           tmpFile2 = fs::path{testing::TempDir()} / "test2.dat";
+    {
+        resizable_file file(tmpFile2, records * sizeof(uint32_t), growth_policy::chunked(16384));
+        EXPECT_EQ(file.committed(), 0);
+
+        // The reader tails the file while it grows, only reading committed records. data() is
+        // only stable once something is committed, so it is not read before then.
+        std::jthread reader([&file] {
+            size_t checked = 0;
+            while (checked < records) {
+                size_t committed = file.committed() / sizeof(uint32_t);
+                if (committed == 0)
+                    continue;
+                auto* values = static_cast<const uint32_t*>(file.data());
+                for (; checked < committed; ++checked)
+                    ASSERT_EQ(values[checked], checked);
+            }
+        });
+        for (uint32_t i = 0; i < records; ++i) {
+            *static_cast<uint32_t*>(file.reserve_append(sizeof(uint32_t))) = i;
+            file.commit(file.size());
+        }
+        reader.join();
+        EXPECT_EQ(file.committed(), file.size());
+
+        // Committing past size() is clamped and shrinking lowers it
+        file.commit(file.capacity() + 1);
+        EXPECT_EQ(file.committed(), file.size());
+        file.resize(8);
+        EXPECT_EQ(file.committed(), 8);
+    }
+    fs::remove(tmpFile2);
+}
+
+TEST_F(MappedFileFixture, StreamingFile) {
+    fs::path tmpFile2 = fs::path{testing::TempDir()} / "test2.dat";
+    size_t   chunkSize = 64 * 1024;
+    size_t   total = chunkSize * 7 / 2 + 3;
+    {
+        streaming_file file(tmpFile2, 1024 * 1024, chunkSize);
+        void*          data = nullptr;
+        for (size_t size = 0; size < total;) {
+            size_t step = std::min<size_t>(1000, total - size);
+            file.resize(size + step);
+            if (!data)
+                data = file.data();
+            EXPECT_EQ(file.data(), data);
+            for (size_t i = size; i < size + step; ++i)
+                static_cast<uint8_t*>(file.data())[i] = uint8_t(i * 7);
+            size += step;
+        }
+        file.flush();
+        EXPECT_THROW(file.resize(0), mapping_error);
+        EXPECT_THROW(file.resize(file.capacity() + 1), std::bad_alloc);
+#ifndef _WIN32
+        // Written chunks are discarded
+        EXPECT_EQ(static_cast<uint8_t*>(file.data())[1], 0);
+#endif
+    }
+    EXPECT_EQ(fs::file_size(tmpFile2), total);
+    {
+        file mapped(tmpFile2);
+        auto bytes = static_cast<const uint8_t*>(mapped.data());
+        for (size_t i = 0; i < total; ++i)
+            ASSERT_EQ(bytes[i], uint8_t(i * 7)) << i;
+    }
+    fs::remove(tmpFile2);
+    EXPECT_FALSE(fs::exists(tmpFile2));
+}
+
 TEST_F(MappedFileFixture, Readme) {
     fs::path       tmpFile2 = fs::path{testing::TempDir()} / "test2.dat";
     {